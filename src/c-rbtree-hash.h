@@ -0,0 +1,285 @@
+#pragma once
+
+/*
+ * c-rbtree-hash: Hashed RB-Trees
+ *
+ * Companion header of the c-rbtree library, providing trees with an intrusive
+ * hash index for exact-match lookups.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * DOC:
+ *
+ * The ``c-rbtree-hash.h`` header combines a tree with a hash table over the
+ * same entries. Entries embed a :c:struct:`CRBHashNode`, which contains both
+ * the tree node and the hash table link. Insertion and removal keep both in
+ * sync. Exact-match lookups go through the hash table in O(1) expected time,
+ * while ordered traversals and range queries use the tree via the regular
+ * c-rbtree API.
+ *
+ * Like the tree, the hash table does not allocate memory. The caller provides
+ * the bucket array, whose size must be a power of two, and replaces it via
+ * :c:func:`c_rbtree_hash_rehash()` when the table gets too crowded. Hash
+ * values are computed by the caller and cached in the nodes, so rehashing
+ * does not need to compute them again.
+ *
+ * The tree must not be modified via the plain c-rbtree API, since this would
+ * bypass the hash table. Note that lockless readers are not supported by the
+ * hash table.
+ */
+/**/
+
+#include <assert.h>
+#include <stddef.h>
+#include "c-rbtree.h"
+
+typedef struct CRBHashNode CRBHashNode;
+typedef struct CRBHashTree CRBHashTree;
+
+/**
+ * struct CRBHashNode - Node of a hashed tree
+ *
+ * This node is embedded into the entries of a :c:struct:`CRBHashTree`. The
+ * ``rb`` member is linked into the tree, and can be used with the read-only
+ * tree API (e.g., iterators and :c:func:`c_rbnode_next()`). All other
+ * members are private.
+ *
+ * There is no need to initialize nodes before they are added to a tree.
+ * However, if you want to call :c:func:`c_rbtree_hash_remove()` on nodes that
+ * might not be linked, you must initialize them via
+ * :c:func:`c_rbtree_hash_node_init()` or :c:macro:`C_RBHASHNODE_INIT()`.
+ */
+struct CRBHashNode {
+        /** Node linked into the tree */
+        CRBNode rb;
+        /* Next node in the same bucket, or NULL */
+        CRBHashNode *__next;
+        /* Link pointing to this node */
+        CRBHashNode **__pprev;
+        /* Cached hash value */
+        size_t __hash;
+};
+
+/**
+ * C_RBHASHNODE_INIT() - Initialize hash node
+ * @_var:               Backpointer to the variable
+ *
+ * Set the contents of the specified node to its unlinked state.
+ *
+ * Return: Evaluates to the initializer for `_var`.
+ */
+#define C_RBHASHNODE_INIT(_var) { .rb = C_RBNODE_INIT((_var).rb) }
+
+/**
+ * struct CRBHashTree - Tree with hash index
+ *
+ * This combines a :c:struct:`CRBTree` with a hash table. The ``tree`` member
+ * can be accessed read-only. All other members are private. See
+ * :c:func:`c_rbtree_hash_init()` for details.
+ */
+struct CRBHashTree {
+        /** Tree of all entries */
+        CRBTree tree;
+        /* Caller provided bucket array */
+        CRBHashNode **__buckets;
+        /* Number of buckets, a power of two */
+        size_t __n_buckets;
+        /* Number of linked nodes */
+        size_t __n_nodes;
+};
+
+/**
+ * c_rbtree_hash_init() - Initialize hashed tree
+ * @ht:         Hashed tree to initialize
+ * @buckets:    Bucket array to use
+ * @n_buckets:  Number of buckets in ``buckets``
+ *
+ * This initializes ``ht`` as an empty hashed tree, using ``buckets`` as
+ * bucket array. ``n_buckets`` must be a power of two. The buckets are
+ * initialized by this function, and must stay valid for as long as they are
+ * used by ``ht``.
+ */
+static inline void c_rbtree_hash_init(CRBHashTree *ht, CRBHashNode **buckets, size_t n_buckets) {
+        size_t i;
+
+        assert(ht);
+        assert(buckets);
+        assert(n_buckets && !(n_buckets & (n_buckets - 1)));
+
+        for (i = 0; i < n_buckets; ++i)
+                buckets[i] = NULL;
+
+        c_rbtree_init(&ht->tree);
+        ht->__buckets = buckets;
+        ht->__n_buckets = n_buckets;
+        ht->__n_nodes = 0;
+}
+
+/**
+ * c_rbtree_hash_node_init() - Mark hash node as unlinked
+ * @n:          Node to operate on
+ *
+ * This marks ``n`` as unlinked, so :c:func:`c_rbtree_hash_remove()` can be
+ * called on it safely. Removed nodes are left in this state as well.
+ */
+static inline void c_rbtree_hash_node_init(CRBHashNode *n) {
+        *n = (CRBHashNode)C_RBHASHNODE_INIT(*n);
+}
+
+/**
+ * c_rbtree_hash_size() - Query number of entries
+ * @ht:         Hashed tree to query
+ *
+ * This returns the number of nodes linked into ``ht``. Callers can use this to
+ * decide when to grow the bucket array.
+ *
+ * Return: Number of linked nodes.
+ */
+static inline size_t c_rbtree_hash_size(CRBHashTree *ht) {
+        return ht->__n_nodes;
+}
+
+/* implementation detail */
+static inline void c_rbtree_hash_link(CRBHashTree *ht, CRBHashNode *n) {
+        CRBHashNode **b = &ht->__buckets[n->__hash & (ht->__n_buckets - 1)];
+
+        n->__next = *b;
+        n->__pprev = b;
+        if (*b)
+                (*b)->__pprev = &n->__next;
+        *b = n;
+}
+
+/**
+ * c_rbtree_hash_find() - Find node by key
+ * @ht:         Hashed tree to search through
+ * @f:          Comparison function
+ * @k:          Key to search for
+ * @hash:       Hash value of ``k``
+ *
+ * This searches the bucket of ``hash`` for a node that compares equal to
+ * ``k``. ``f`` is only invoked on nodes with the same hash value, and only its
+ * equality is used. It is passed the tree and ``rb`` member of the node, just
+ * like on tree lookups, so the same function can be used for both.
+ *
+ * Expected runtime: O(1)
+ *
+ * Return: Pointer to matching node, or NULL.
+ */
+static inline CRBHashNode *c_rbtree_hash_find(CRBHashTree *ht, CRBCompareFunc f, const void *k, size_t hash) {
+        CRBHashNode *i;
+
+        assert(ht);
+        assert(f);
+
+        for (i = ht->__buckets[hash & (ht->__n_buckets - 1)]; i; i = i->__next)
+                if (i->__hash == hash && !f(&ht->tree, (void *)k, &i->rb))
+                        return i;
+
+        return NULL;
+}
+
+/**
+ * c_rbtree_hash_add() - Add node to hashed tree
+ * @ht:         Hashed tree to operate on
+ * @f:          Comparison function
+ * @k:          Key of ``n``
+ * @hash:       Hash value of ``k``
+ * @n:          Node to add
+ *
+ * This links ``n`` into both the tree and the hash table of ``ht``. If a node
+ * that compares equal to ``k`` is already linked, ``n`` is not added, and the
+ * conflicting node is returned instead.
+ *
+ * Worst case runtime (n: number of elements in tree): O(log(n))
+ *
+ * Return: NULL on success, or pointer to the conflicting node.
+ */
+static inline CRBHashNode *c_rbtree_hash_add(CRBHashTree *ht,
+                                             CRBCompareFunc f,
+                                             const void *k,
+                                             size_t hash,
+                                             CRBHashNode *n) {
+        CRBNode **slot, *p;
+
+        assert(ht);
+        assert(n);
+
+        slot = c_rbtree_find_slot(&ht->tree, f, k, &p);
+        if (!slot)
+                return c_rbnode_entry(p, CRBHashNode, rb);
+
+        c_rbtree_add(&ht->tree, p, slot, &n->rb);
+        n->__hash = hash;
+        c_rbtree_hash_link(ht, n);
+        ++ht->__n_nodes;
+        return NULL;
+}
+
+/**
+ * c_rbtree_hash_remove() - Remove node from hashed tree
+ * @ht:         Hashed tree to operate on
+ * @n:          Node to remove
+ *
+ * This unlinks ``n`` from both the tree and the hash table of ``ht``, and
+ * marks it as unlinked (see :c:func:`c_rbtree_hash_node_init()`). If ``n`` is
+ * marked as unlinked already, this is a no-op. Nodes that were neither
+ * initialized nor linked must not be passed.
+ *
+ * Worst case runtime (n: number of elements in tree): O(log(n))
+ */
+static inline void c_rbtree_hash_remove(CRBHashTree *ht, CRBHashNode *n) {
+        assert(ht);
+        assert(n);
+
+        if (!c_rbnode_is_linked(&n->rb))
+                return;
+
+        c_rbnode_unlink(&n->rb);
+        *n->__pprev = n->__next;
+        if (n->__next)
+                n->__next->__pprev = n->__pprev;
+        n->__next = NULL;
+        n->__pprev = NULL;
+        --ht->__n_nodes;
+}
+
+/**
+ * c_rbtree_hash_rehash() - Replace bucket array
+ * @ht:         Hashed tree to operate on
+ * @buckets:    New bucket array to use
+ * @n_buckets:  Number of buckets in ``buckets``
+ *
+ * This moves all nodes of ``ht`` into the new bucket array ``buckets``.
+ * ``n_buckets`` must be a power of two. The cached hash values are used, so
+ * no key is accessed. The old bucket array is no longer used afterwards, and
+ * can be released by the caller.
+ *
+ * Worst case runtime (n: number of elements in tree): O(n)
+ */
+static inline void c_rbtree_hash_rehash(CRBHashTree *ht, CRBHashNode **buckets, size_t n_buckets) {
+        CRBHashNode *n;
+        size_t i;
+
+        assert(ht);
+        assert(buckets);
+        assert(n_buckets && !(n_buckets & (n_buckets - 1)));
+
+        for (i = 0; i < n_buckets; ++i)
+                buckets[i] = NULL;
+
+        ht->__buckets = buckets;
+        ht->__n_buckets = n_buckets;
+
+        /* the tree links all nodes, so there is no need to walk the buckets */
+        c_rbtree_for_each_entry(n, &ht->tree, rb)
+                c_rbtree_hash_link(ht, n);
+}
+
+#ifdef __cplusplus
+}
+#endif
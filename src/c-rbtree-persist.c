@@ -0,0 +1,486 @@
+/*
+ * Persistent RB-Tree Implementation
+ *
+ * This implements persistent RB-Trees based on join and split, rather than on
+ * the classic insertion and removal cases. Both are expressed recursively,
+ * which makes path-copying straightforward: Every node on the path is taken
+ * over via c_rbtree_persist_own() before it is modified, which copies it if
+ * it is shared with another version. See "Just Join for Parallel Ordered
+ * Sets" (Blelloch, Ferizovic, Sun) for a description of the algorithms.
+ *
+ * All helpers operate on owned references. That is, a helper consumes the
+ * references of the trees passed to it, and returns a reference to its result.
+ * Recursion is bounded by the tree height, which is O(log(n)).
+ *
+ * Every node caches its black-height (the number of black nodes on every path
+ * from the node to a leaf, including the node itself), so joining trees does
+ * not need to walk them to compare their heights.
+ */
+
+#include <assert.h>
+#include <c-stdaux.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include "c-rbtree-persist.h"
+
+#define C_RBPERSISTNODE_RED (0x1UL)
+
+static inline unsigned long c_rbpersistnode_bh(CRBPersistNode *n) {
+        return n ? n->__rank >> 1 : 0;
+}
+
+static inline _Bool c_rbpersistnode_is_red(CRBPersistNode *n) {
+        return n && (n->__rank & C_RBPERSISTNODE_RED);
+}
+
+static CRBPersistNode *c_rbtree_persist_ref(CRBPersistNode *n) {
+        if (n)
+                atomic_fetch_add_explicit(&n->__n_refs, 1, memory_order_relaxed);
+        return n;
+}
+
+static void c_rbtree_persist_unref(CRBPersistTree *t, CRBPersistNode *n) {
+        CRBPersistNode *l, *r;
+
+        /* recurse into the left sub-tree, but loop into the right sub-tree */
+        while (n && atomic_fetch_sub_explicit(&n->__n_refs, 1, memory_order_acq_rel) == 1) {
+                l = n->left;
+                r = n->right;
+                t->__free(n, t->__userdata);
+                c_rbtree_persist_unref(t, l);
+                n = r;
+        }
+}
+
+/*
+ * Take over the node @n for modification. If no other version references @n,
+ * it is returned unchanged. Otherwise, a copy is returned, which references
+ * the same children, and the reference to @n is dropped. Either way, the
+ * caller owns the only reference to the returned node.
+ */
+static CRBPersistNode *c_rbtree_persist_own(CRBPersistTree *t, CRBPersistNode *n) {
+        CRBPersistNode *c;
+
+        if (atomic_load_explicit(&n->__n_refs, memory_order_acquire) == 1)
+                return n;
+
+        c = t->__copy(n, t->__userdata);
+        c_assert(c && c != n);
+
+        c->left = c_rbtree_persist_ref(n->left);
+        c->right = c_rbtree_persist_ref(n->right);
+        c->__rank = n->__rank;
+        atomic_init(&c->__n_refs, 1);
+
+        c_rbtree_persist_unref(t, n);
+        return c;
+}
+
+/* link @l and @r as children of the owned node @n, and color it */
+static CRBPersistNode *c_rbtree_persist_link(CRBPersistNode *n, CRBPersistNode *l, CRBPersistNode *r, _Bool red) {
+        c_assert(c_rbpersistnode_bh(l) == c_rbpersistnode_bh(r));
+
+        n->left = l;
+        n->right = r;
+        n->__rank = ((c_rbpersistnode_bh(l) + !red) << 1) | (red ? C_RBPERSISTNODE_RED : 0);
+        return n;
+}
+
+static CRBPersistNode *c_rbtree_persist_paint(CRBPersistTree *t, CRBPersistNode *n, _Bool red) {
+        n = c_rbtree_persist_own(t, n);
+        return c_rbtree_persist_link(n, n->left, n->right, red);
+}
+
+/*
+ * Join @l, the node @k, and @r, where @l is at least as high as @r, and @r is
+ * black. This descends the right border of @l to the first black node of the
+ * same black-height as @r, and replaces it with @k in red. If this leaves two
+ * red nodes in a row, the grand-child is painted black and the black parent
+ * rotated left. The result has the same black-height as @l, but its root
+ * might be red with a red right child.
+ */
+static CRBPersistNode *c_rbtree_persist_join_right(CRBPersistTree *t,
+                                                   CRBPersistNode *l,
+                                                   CRBPersistNode *k,
+                                                   CRBPersistNode *r) {
+        CRBPersistNode *c;
+
+        if (!c_rbpersistnode_is_red(l) && c_rbpersistnode_bh(l) == c_rbpersistnode_bh(r))
+                return c_rbtree_persist_link(k, l, r, 1);
+
+        l = c_rbtree_persist_own(t, l);
+        c = c_rbtree_persist_join_right(t, l->right, k, r);
+
+        if (!c_rbpersistnode_is_red(l) && c_rbpersistnode_is_red(c) && c_rbpersistnode_is_red(c->right)) {
+                c->right = c_rbtree_persist_paint(t, c->right, 0);
+                c_rbtree_persist_link(l, l->left, c->left, 0);
+                return c_rbtree_persist_link(c, l, c->right, 1);
+        }
+
+        return c_rbtree_persist_link(l, l->left, c, c_rbpersistnode_is_red(l));
+}
+
+/* mirrored version of c_rbtree_persist_join_right() */
+static CRBPersistNode *c_rbtree_persist_join_left(CRBPersistTree *t,
+                                                  CRBPersistNode *l,
+                                                  CRBPersistNode *k,
+                                                  CRBPersistNode *r) {
+        CRBPersistNode *c;
+
+        if (!c_rbpersistnode_is_red(r) && c_rbpersistnode_bh(r) == c_rbpersistnode_bh(l))
+                return c_rbtree_persist_link(k, l, r, 1);
+
+        r = c_rbtree_persist_own(t, r);
+        c = c_rbtree_persist_join_left(t, l, k, r->left);
+
+        if (!c_rbpersistnode_is_red(r) && c_rbpersistnode_is_red(c) && c_rbpersistnode_is_red(c->left)) {
+                c->left = c_rbtree_persist_paint(t, c->left, 0);
+                c_rbtree_persist_link(r, c->right, r->right, 0);
+                return c_rbtree_persist_link(c, c->left, r, 1);
+        }
+
+        return c_rbtree_persist_link(r, c, r->right, c_rbpersistnode_is_red(r));
+}
+
+/*
+ * Join @l, the owned node @k, and @r. All nodes of @l must order before @k,
+ * and @k before all nodes of @r. The result might have a red root.
+ */
+static CRBPersistNode *c_rbtree_persist_join(CRBPersistTree *t,
+                                             CRBPersistNode *l,
+                                             CRBPersistNode *k,
+                                             CRBPersistNode *r) {
+        CRBPersistNode *n;
+
+        if (c_rbpersistnode_is_red(l))
+                l = c_rbtree_persist_paint(t, l, 0);
+        if (c_rbpersistnode_is_red(r))
+                r = c_rbtree_persist_paint(t, r, 0);
+
+        if (c_rbpersistnode_bh(l) > c_rbpersistnode_bh(r)) {
+                n = c_rbtree_persist_join_right(t, l, k, r);
+                if (c_rbpersistnode_is_red(n) && c_rbpersistnode_is_red(n->right))
+                        n = c_rbtree_persist_link(n, n->left, n->right, 0);
+        } else if (c_rbpersistnode_bh(l) < c_rbpersistnode_bh(r)) {
+                n = c_rbtree_persist_join_left(t, l, k, r);
+                if (c_rbpersistnode_is_red(n) && c_rbpersistnode_is_red(n->left))
+                        n = c_rbtree_persist_link(n, n->left, n->right, 0);
+        } else {
+                n = c_rbtree_persist_link(k, l, r, 1);
+        }
+
+        return n;
+}
+
+/*
+ * Split @n into all nodes ordering before @k, returned in @lp, and all nodes
+ * ordering after @k, returned in @rp. If a node compares equal to @k, it is
+ * detached and returned as owned node. Otherwise, NULL is returned.
+ */
+static CRBPersistNode *c_rbtree_persist_split(CRBPersistTree *t,
+                                              CRBPersistNode *n,
+                                              CRBPersistCompareFunc f,
+                                              const void *k,
+                                              CRBPersistNode **lp,
+                                              CRBPersistNode **rp) {
+        CRBPersistNode *l, *r, *found;
+        int v;
+
+        if (!n) {
+                *lp = NULL;
+                *rp = NULL;
+                return NULL;
+        }
+
+        n = c_rbtree_persist_own(t, n);
+        l = n->left;
+        r = n->right;
+        n->left = NULL;
+        n->right = NULL;
+
+        v = f((void *)k, n);
+        if (v < 0) {
+                found = c_rbtree_persist_split(t, l, f, k, lp, &l);
+                *rp = c_rbtree_persist_join(t, l, n, r);
+        } else if (v > 0) {
+                found = c_rbtree_persist_split(t, r, f, k, &r, rp);
+                *lp = c_rbtree_persist_join(t, l, n, r);
+        } else {
+                found = n;
+                *lp = l;
+                *rp = r;
+        }
+
+        return found;
+}
+
+/* detach the last node of @n as owned node, and return the remainder in @restp */
+static CRBPersistNode *c_rbtree_persist_split_last(CRBPersistTree *t,
+                                                   CRBPersistNode *n,
+                                                   CRBPersistNode **restp) {
+        CRBPersistNode *l, *r, *last;
+
+        n = c_rbtree_persist_own(t, n);
+        l = n->left;
+        r = n->right;
+        n->left = NULL;
+        n->right = NULL;
+
+        if (!r) {
+                *restp = l;
+                return n;
+        }
+
+        last = c_rbtree_persist_split_last(t, r, &r);
+        *restp = c_rbtree_persist_join(t, l, n, r);
+        return last;
+}
+
+/* join @l and @r, where all nodes of @l order before all nodes of @r */
+static CRBPersistNode *c_rbtree_persist_join2(CRBPersistTree *t, CRBPersistNode *l, CRBPersistNode *r) {
+        CRBPersistNode *last;
+
+        if (!l)
+                return r;
+        if (!r)
+                return l;
+
+        last = c_rbtree_persist_split_last(t, l, &l);
+        return c_rbtree_persist_join(t, l, last, r);
+}
+
+/* install @n as new root of @t, painting it black */
+static void c_rbtree_persist_set_root(CRBPersistTree *t, CRBPersistNode *n) {
+        if (c_rbpersistnode_is_red(n))
+                n = c_rbtree_persist_paint(t, n, 0);
+        t->root = n;
+}
+
+/**
+ * c_rbtree_persist_init() - Initialize persistent tree
+ * @t:          Tree to initialize
+ * @copy:       Copy callback
+ * @release:    Release callback
+ * @userdata:   Userdata to pass to the callbacks
+ *
+ * This initializes ``t`` as an empty persistent tree. ``copy`` is called
+ * whenever a node shared with another version must be modified, and
+ * ``release`` is called whenever the last reference to a node is dropped. See
+ * :c:type:`CRBPersistCopyFunc` and :c:type:`CRBPersistFreeFunc` for details.
+ */
+_c_public_ void c_rbtree_persist_init(CRBPersistTree *t,
+                                      CRBPersistCopyFunc copy,
+                                      CRBPersistFreeFunc release,
+                                      void *userdata) {
+        c_assert(t);
+        c_assert(copy);
+        c_assert(release);
+
+        *t = (CRBPersistTree)C_RBPERSISTTREE_INIT(copy, release, userdata);
+}
+
+/**
+ * c_rbtree_persist_deinit() - Deinitialize persistent tree
+ * @t:          Tree to deinitialize
+ *
+ * This drops the reference of ``t`` to its current version, releasing all
+ * nodes not shared with any snapshot. Snapshots stay valid, and must be
+ * released via :c:func:`c_rbtree_persist_release()` before ``t`` is
+ * deallocated.
+ *
+ * Worst case runtime (n: number of elements in tree): O(n)
+ */
+_c_public_ void c_rbtree_persist_deinit(CRBPersistTree *t) {
+        c_assert(t);
+
+        c_rbtree_persist_unref(t, t->root);
+        t->root = NULL;
+}
+
+/**
+ * c_rbtree_persist_add() - Add node to persistent tree
+ * @t:          Tree to operate on
+ * @f:          Comparison function
+ * @k:          Key of ``n``
+ * @n:          Node to add
+ *
+ * This creates a new version of ``t`` with the node ``n`` added, using ``k``
+ * as its key. Nodes shared with snapshots are copied, rather than modified.
+ * The caller passes ownership of ``n`` to the tree. That is, ``n`` is released
+ * via the release callback once it is no longer referenced by any version.
+ *
+ * If a node comparing equal to ``k`` is already present, the tree is not
+ * modified and ``n`` is left untouched.
+ *
+ * Worst case runtime (n: number of elements in tree): O(log(n))
+ *
+ * Return: True if ``n`` was added, false on conflicts.
+ */
+_c_public_ _Bool c_rbtree_persist_add(CRBPersistTree *t, CRBPersistCompareFunc f, const void *k, CRBPersistNode *n) {
+        CRBPersistNode *l, *r, *found;
+
+        c_assert(t);
+        c_assert(n);
+
+        /* verify upfront, so conflicts do not copy anything */
+        if (c_rbtree_persist_find(t->root, f, k))
+                return 0;
+
+        n->left = NULL;
+        n->right = NULL;
+        n->__rank = 0;
+        atomic_init(&n->__n_refs, 1);
+
+        found = c_rbtree_persist_split(t, t->root, f, k, &l, &r);
+        c_assert(!found);
+        c_rbtree_persist_set_root(t, c_rbtree_persist_join(t, l, n, r));
+        return 1;
+}
+
+/**
+ * c_rbtree_persist_remove() - Remove node from persistent tree
+ * @t:          Tree to operate on
+ * @f:          Comparison function
+ * @k:          Key to remove
+ *
+ * This creates a new version of ``t`` without the node that compares equal
+ * to ``k``. Nodes shared with snapshots are copied, rather than modified. The
+ * removed node is released once it is no longer referenced by any snapshot.
+ *
+ * Worst case runtime (n: number of elements in tree): O(log(n))
+ *
+ * Return: True if a node was removed, false if none compared equal to ``k``.
+ */
+_c_public_ _Bool c_rbtree_persist_remove(CRBPersistTree *t, CRBPersistCompareFunc f, const void *k) {
+        CRBPersistNode *l, *r, *found;
+
+        c_assert(t);
+
+        if (!c_rbtree_persist_find(t->root, f, k))
+                return 0;
+
+        found = c_rbtree_persist_split(t, t->root, f, k, &l, &r);
+        c_assert(found);
+        c_rbtree_persist_set_root(t, c_rbtree_persist_join2(t, l, r));
+
+        /* the split detached it from its children, so this only drops @found */
+        c_rbtree_persist_unref(t, found);
+        return 1;
+}
+
+/**
+ * c_rbtree_persist_snapshot() - Take snapshot of persistent tree
+ * @t:          Tree to snapshot
+ *
+ * This takes a reference to the current version of ``t`` and returns its root.
+ * The version is immutable, and stays valid until the snapshot is released
+ * via :c:func:`c_rbtree_persist_release()`, regardless of any further
+ * modifications of ``t``. An empty tree is represented by a NULL snapshot.
+ *
+ * This must be serialized with modifications of ``t``. The returned snapshot
+ * can be passed to any thread, and be traversed without further
+ * synchronization.
+ *
+ * Worst case runtime: O(1)
+ *
+ * Return: Root of the snapshot, or NULL if ``t`` is empty.
+ */
+_c_public_ CRBPersistNode *c_rbtree_persist_snapshot(CRBPersistTree *t) {
+        c_assert(t);
+
+        return c_rbtree_persist_ref(t->root);
+}
+
+/**
+ * c_rbtree_persist_release() - Release snapshot of persistent tree
+ * @t:          Tree the snapshot was taken of
+ * @snapshot:   Snapshot to release, or NULL
+ *
+ * This drops the reference to ``snapshot``, and releases all its nodes that
+ * are no longer referenced by any other version. This can be called on any
+ * thread, without synchronizing with modifications of ``t``.
+ *
+ * Worst case runtime (n: number of elements in snapshot): O(n)
+ */
+_c_public_ void c_rbtree_persist_release(CRBPersistTree *t, CRBPersistNode *snapshot) {
+        c_assert(t);
+
+        c_rbtree_persist_unref(t, snapshot);
+}
+
+/**
+ * c_rbtree_persist_iter_init() - Initialize cursor
+ * @it:         Cursor to initialize
+ * @root:       Root of the version to iterate
+ *
+ * This positions the cursor ``it`` in front of the first node of the version
+ * with root ``root``. Use :c:func:`c_rbtree_persist_iter_next()` to advance
+ * it. The version must stay referenced while the cursor is used.
+ */
+_c_public_ void c_rbtree_persist_iter_init(CRBPersistIter *it, CRBPersistNode *root) {
+        c_assert(it);
+
+        for (it->__n_stack = 0; root; root = root->left) {
+                c_assert(it->__n_stack < C_ARRAY_SIZE(it->__stack));
+                it->__stack[it->__n_stack++] = root;
+        }
+}
+
+/**
+ * c_rbtree_persist_iter_seek() - Position cursor at lower bound
+ * @it:         Cursor to position
+ * @root:       Root of the version to iterate
+ * @f:          Comparison function
+ * @k:          Key to seek to
+ *
+ * This positions the cursor ``it`` in front of the first node of the version
+ * with root ``root`` that does not order before ``k``.
+ *
+ * Worst case runtime (n: number of elements in version): O(log(n))
+ */
+_c_public_ void c_rbtree_persist_iter_seek(CRBPersistIter *it,
+                                           CRBPersistNode *root,
+                                           CRBPersistCompareFunc f,
+                                           const void *k) {
+        c_assert(it);
+        c_assert(f);
+
+        /* remember every node we descend left from, as it follows @k */
+        for (it->__n_stack = 0; root; ) {
+                if (f((void *)k, root) > 0) {
+                        root = root->right;
+                } else {
+                        c_assert(it->__n_stack < C_ARRAY_SIZE(it->__stack));
+                        it->__stack[it->__n_stack++] = root;
+                        root = root->left;
+                }
+        }
+}
+
+/**
+ * c_rbtree_persist_iter_next() - Advance cursor
+ * @it:         Cursor to advance
+ *
+ * This advances the cursor ``it`` past the next node, and returns that node.
+ *
+ * Worst case runtime (n: number of elements in version): O(log(n)), amortized
+ * O(1) over a full traversal.
+ *
+ * Return: Pointer to next node, or NULL at the end of the version.
+ */
+_c_public_ CRBPersistNode *c_rbtree_persist_iter_next(CRBPersistIter *it) {
+        CRBPersistNode *n, *i;
+
+        c_assert(it);
+
+        if (!it->__n_stack)
+                return NULL;
+
+        n = it->__stack[--it->__n_stack];
+        for (i = n->right; i; i = i->left) {
+                c_assert(it->__n_stack < C_ARRAY_SIZE(it->__stack));
+                it->__stack[it->__n_stack++] = i;
+        }
+
+        return n;
+}
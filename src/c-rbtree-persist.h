@@ -0,0 +1,208 @@
+#pragma once
+
+/*
+ * c-rbtree-persist: Persistent RB-Trees
+ *
+ * Companion header of the c-rbtree library, providing persistent RB-Trees,
+ * which can be snapshotted in constant time.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * DOC:
+ *
+ * The ``c-rbtree-persist.h`` header provides a persistent flavor of RB-Trees.
+ * Modifications never change nodes that are shared with a snapshot. Instead,
+ * the nodes on the modified path are copied (path-copying), and the copies are
+ * linked into a new version of the tree. Every version is identified by its
+ * root node, and stays valid and immutable for as long as it is referenced.
+ * Taking a snapshot thus only takes a reference to the current root.
+ *
+ * Nodes are shared between versions, so they cannot carry a parent pointer.
+ * Hence, persistent trees use their own node type
+ * :c:struct:`CRBPersistNode`, and in-order traversal uses an explicit cursor
+ * (see :c:struct:`CRBPersistIter`). Each node carries a reference count,
+ * counting the links and snapshots that point to it. Nodes are released via
+ * a callback once their last reference is dropped.
+ *
+ * The library does not allocate memory. Instead, the caller provides a
+ * callback to copy entries when a shared node is modified. Nodes that are not
+ * shared with any snapshot are modified in place.
+ *
+ * Modifications and snapshots must be serialized by the caller (e.g., via a
+ * mutex). Snapshots can then be traversed and released on any thread without
+ * holding the lock, in parallel to further modifications. Callbacks might be
+ * invoked on any thread that drops a reference.
+ */
+/**/
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+typedef struct CRBPersistNode CRBPersistNode;
+typedef struct CRBPersistTree CRBPersistTree;
+typedef struct CRBPersistIter CRBPersistIter;
+
+/**
+ * CRBPersistCompareFunc - Function type to compare a key to a node
+ *
+ * This is the equivalent of :c:type:`CRBCompareFunc` for persistent trees. It
+ * must return less than, equal to, or greater than 0 if ``k`` orders before,
+ * equal to, or after the node ``n``, respectively.
+ */
+typedef int (*CRBPersistCompareFunc) (void *k, CRBPersistNode *n);
+
+/**
+ * CRBPersistCopyFunc - Function type to copy an entry
+ *
+ * This callback is used whenever a node shared with a snapshot is modified. It
+ * must copy the entry embedding the node ``n`` to a new memory location, and
+ * return a pointer to the embedded node of the copy. The node links and the
+ * reference count of the copy are initialized by the caller. The callback must
+ * not fail, nor access the tree. ``userdata`` is passed through unchanged.
+ */
+typedef CRBPersistNode *(*CRBPersistCopyFunc) (CRBPersistNode *n, void *userdata);
+
+/**
+ * CRBPersistFreeFunc - Function type to release an entry
+ *
+ * This callback is used to release the entry embedding the node ``n``, once
+ * the last reference to it was dropped. The node links must not be accessed.
+ * ``userdata`` is passed through unchanged.
+ */
+typedef void (*CRBPersistFreeFunc) (CRBPersistNode *n, void *userdata);
+
+/**
+ * struct CRBPersistNode - Node of a persistent tree
+ * @left:       Left child, or NULL
+ * @right:      Right child, or NULL
+ * @__rank:     Black-height and color
+ * @__n_refs:   Reference counter
+ *
+ * Nodes are embedded into the entries of a persistent tree, just like
+ * :c:struct:`CRBNode`. The ``left`` and ``right`` members can be accessed
+ * read-only to traverse a version. All other members are private.
+ *
+ * There is no need to initialize nodes before they are added to a tree.
+ */
+struct CRBPersistNode {
+        CRBPersistNode *left;
+        CRBPersistNode *right;
+        unsigned long __rank;
+        atomic_ulong __n_refs;
+};
+
+/**
+ * struct CRBPersistTree - Persistent tree
+ * @root:       Root of the current version, or NULL
+ * @__copy:     Copy callback
+ * @__free:     Release callback
+ * @__userdata: Userdata passed to the callbacks
+ *
+ * This is the writer side of a persistent tree. ``root`` refers to the current
+ * version. It can be accessed read-only by the writer. See
+ * :c:func:`c_rbtree_persist_init()` for details.
+ */
+struct CRBPersistTree {
+        CRBPersistNode *root;
+        CRBPersistCopyFunc __copy;
+        CRBPersistFreeFunc __free;
+        void *__userdata;
+};
+
+#define C_RBPERSISTTREE_INIT(_copy, _release, _userdata) {                     \
+                .__copy = (_copy),                                              \
+                .__free = (_release),                                           \
+                .__userdata = (_userdata),                                      \
+        }
+
+/*
+ * The height of an RB-Tree is at most 2 * log2(n + 1). Even if all addressable
+ * memory was filled with nodes, this cannot exceed 128 layers.
+ */
+#define C_RBTREE_PERSIST_MAX_DEPTH (128)
+
+/**
+ * struct CRBPersistIter - Cursor of a persistent tree
+ * @__stack:    Pending ancestors
+ * @__n_stack:  Number of pending ancestors
+ *
+ * This is an in-order cursor over a version of a persistent tree. It keeps
+ * track of all ancestors that are still to be visited, since nodes do not
+ * link to their parents. See :c:func:`c_rbtree_persist_iter_init()` for
+ * details.
+ *
+ * All members are private.
+ */
+struct CRBPersistIter {
+        CRBPersistNode *__stack[C_RBTREE_PERSIST_MAX_DEPTH];
+        size_t __n_stack;
+};
+
+void c_rbtree_persist_init(CRBPersistTree *t, CRBPersistCopyFunc copy, CRBPersistFreeFunc release, void *userdata);
+void c_rbtree_persist_deinit(CRBPersistTree *t);
+_Bool c_rbtree_persist_add(CRBPersistTree *t, CRBPersistCompareFunc f, const void *k, CRBPersistNode *n);
+_Bool c_rbtree_persist_remove(CRBPersistTree *t, CRBPersistCompareFunc f, const void *k);
+CRBPersistNode *c_rbtree_persist_snapshot(CRBPersistTree *t);
+void c_rbtree_persist_release(CRBPersistTree *t, CRBPersistNode *snapshot);
+
+void c_rbtree_persist_iter_init(CRBPersistIter *it, CRBPersistNode *root);
+void c_rbtree_persist_iter_seek(CRBPersistIter *it, CRBPersistNode *root, CRBPersistCompareFunc f, const void *k);
+CRBPersistNode *c_rbtree_persist_iter_next(CRBPersistIter *it);
+
+/**
+ * c_rbtree_persist_find() - Find node in a version
+ * @root:       Root of the version to search through
+ * @f:          Comparison function
+ * @k:          Key to search for
+ *
+ * This searches through the version of a persistent tree with root ``root``
+ * for a node that compares equal to ``k``. ``root`` is usually a snapshot
+ * (see :c:func:`c_rbtree_persist_snapshot()`), or the current root of the
+ * tree, if called by the writer.
+ *
+ * Worst case runtime (n: number of elements in version): O(log(n))
+ *
+ * Return: Pointer to matching node, or NULL.
+ */
+static inline CRBPersistNode *c_rbtree_persist_find(CRBPersistNode *root, CRBPersistCompareFunc f, const void *k) {
+        CRBPersistNode *i = root;
+        int v;
+
+        assert(f);
+
+        while (i) {
+                v = f((void *)k, i);
+                if (v < 0)
+                        i = i->left;
+                else if (v > 0)
+                        i = i->right;
+                else
+                        return i;
+        }
+
+        return NULL;
+}
+
+/**
+ * c_rbtree_persist_for_each() - Iterate a version in order
+ * @_iter:      Iterator variable
+ * @_it:        Cursor to use
+ * @_root:      Root of the version to iterate
+ *
+ * This iterates all nodes of the version with root ``_root`` in order, storing
+ * each in ``_iter``. ``_it`` is used as cursor.
+ */
+#define c_rbtree_persist_for_each(_iter, _it, _root)                            \
+        for (c_rbtree_persist_iter_init((_it), (_root)),                        \
+             _iter = c_rbtree_persist_iter_next(_it);                           \
+             _iter;                                                             \
+             _iter = c_rbtree_persist_iter_next(_it))
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,869 @@
+#pragma once
+
+/*
+ * c-rbtree-sync: Synchronization of Lockless Readers
+ *
+ * Companion header of the c-rbtree library, providing helpers to run lockless
+ * readers in parallel to a writer.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * DOC:
+ *
+ * The ``c-rbtree-sync.h`` header provides helpers to synchronize lockless
+ * readers of a tree with a single writer. It is kept separate from
+ * ``c-rbtree.h``, since it relies on ``<stdatomic.h>``.
+ *
+ * All tree modifications of c-rbtree use release-stores, so the writer never
+ * publishes a link before the stores it depends on. The readers of the
+ * generic tree API use plain loads, though, so C11 gives no guarantee about
+ * what a reader racing a modification observes. In particular, a reader
+ * racing a rebalancing operation might skip entire sub-trees, and thus
+ * produce wrong results. The helpers in this header detect such races and
+ * retry the read operation, so only validated results are used.
+ *
+ * Lockless readers require the library to be built with lockless readers
+ * enabled (which is the default).
+ */
+/**/
+
+#include <assert.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include "c-rbtree.h"
+
+typedef struct CRBSeqTree CRBSeqTree;
+typedef struct CRBEpoch CRBEpoch;
+typedef struct CRBEpochEntry CRBEpochEntry;
+typedef struct CRBEpochReader CRBEpochReader;
+typedef void (*CRBEpochFreeFunc) (CRBEpochEntry *entry, void *userdata);
+typedef struct CRBHazard CRBHazard;
+typedef struct CRBHazardEntry CRBHazardEntry;
+typedef struct CRBHazardReader CRBHazardReader;
+typedef void (*CRBHazardFreeFunc) (CRBHazardEntry *entry, void *userdata);
+
+/**
+ * DOC: Sequence Counters
+ *
+ * A :c:struct:`CRBSeqTree` combines a tree with a sequence counter. The writer
+ * increments the counter before and after each modification, so it is odd
+ * while a modification is in progress. A reader samples the counter before
+ * it traverses the tree, and checks it did not change afterwards. Otherwise,
+ * the result might be wrong and the reader retries.
+ *
+ * Writers must be serialized by the caller (e.g., via a mutex). Readers need
+ * no lock. The writer must not release the memory of unlinked nodes while
+ * readers might still access them, and the comparison functions must be safe
+ * to call on such nodes. Readers must not dereference any node they got from
+ * a read operation outside of the read section, unless they synchronize with
+ * the writer by other means.
+ */
+/**/
+
+/**
+ * struct CRBSeqTree - Tree with a sequence counter
+ *
+ * This wraps a :c:struct:`CRBTree` with a sequence counter for lockless
+ * readers. The ``tree`` member can be accessed directly by the writer.
+ *
+ * To initialize, set it to all zero or assign :c:macro:`C_RBSEQTREE_INIT`.
+ */
+struct CRBSeqTree {
+        /** Tree protected by the sequence counter */
+        CRBTree tree;
+        /* Sequence counter, odd while a modification is in progress */
+        atomic_ulong __seq;
+};
+
+/**
+ * C_RBSEQTREE_INIT() - Initialize RBSeqTree Object
+ *
+ * Return: Evaluates to the initializer for a :c:struct:`CRBSeqTree` object.
+ */
+#define C_RBSEQTREE_INIT { .tree = C_RBTREE_INIT }
+
+/**
+ * c_rbtree_seq_init() - Initialize a new sequence counted tree
+ * @st:         Tree to operate on
+ */
+static inline void c_rbtree_seq_init(CRBSeqTree *st) {
+        c_rbtree_init(&st->tree);
+        atomic_init(&st->__seq, 0);
+}
+
+/**
+ * c_rbtree_seq_write_begin() - Begin a modification
+ * @st:         Tree to operate on
+ *
+ * This marks the start of a modification of the tree. Any reader that
+ * overlaps with the modification will retry. This must be paired with a call
+ * to :c:func:`c_rbtree_seq_write_end()`. Modifications must not be nested.
+ */
+static inline void c_rbtree_seq_write_begin(CRBSeqTree *st) {
+        unsigned long seq = atomic_load_explicit(&st->__seq, memory_order_relaxed);
+
+        assert(!(seq & 1));
+
+        atomic_store_explicit(&st->__seq, seq + 1, memory_order_relaxed);
+        /* order the counter update before any tree modification */
+        atomic_thread_fence(memory_order_release);
+}
+
+/**
+ * c_rbtree_seq_write_end() - End a modification
+ * @st:         Tree to operate on
+ *
+ * This marks the end of a modification started via
+ * :c:func:`c_rbtree_seq_write_begin()`.
+ */
+static inline void c_rbtree_seq_write_end(CRBSeqTree *st) {
+        unsigned long seq = atomic_load_explicit(&st->__seq, memory_order_relaxed);
+
+        assert(seq & 1);
+
+        /* order all tree modifications before the counter update */
+        atomic_store_explicit(&st->__seq, seq + 1, memory_order_release);
+}
+
+/**
+ * c_rbtree_seq_add() - Add node to tree
+ * @st:         Tree to operate on
+ * @p:          Parent node to link under, or NULL
+ * @l:          Left/right slot of @p (or root) to link at
+ * @n:          Node to add
+ *
+ * This is :c:func:`c_rbtree_add()` wrapped in a modification.
+ */
+static inline void c_rbtree_seq_add(CRBSeqTree *st, CRBNode *p, CRBNode **l, CRBNode *n) {
+        c_rbtree_seq_write_begin(st);
+        c_rbtree_add(&st->tree, p, l, n);
+        c_rbtree_seq_write_end(st);
+}
+
+/**
+ * c_rbtree_seq_unlink() - Remove node from tree
+ * @st:         Tree to operate on
+ * @n:          Node to remove, or NULL
+ *
+ * This is :c:func:`c_rbnode_unlink_stale()` wrapped in a modification. The
+ * node is left untouched, so lockless readers currently on the node can
+ * continue their traversal (and then retry). It is up to the caller to
+ * reinitialize the node via :c:func:`c_rbnode_init()`, once no reader can
+ * reach it anymore. Until then, :c:func:`c_rbnode_is_linked()` cannot be used
+ * on it.
+ */
+static inline void c_rbtree_seq_unlink(CRBSeqTree *st, CRBNode *n) {
+        c_rbtree_seq_write_begin(st);
+        c_rbnode_unlink_stale(n);
+        c_rbtree_seq_write_end(st);
+}
+
+/**
+ * c_rbtree_seq_read_begin() - Begin a read section
+ * @st:         Tree to operate on
+ *
+ * This starts a read section and returns the sequence number to pass to
+ * :c:func:`c_rbtree_seq_read_retry()` once the read section is done. If a
+ * modification is in progress, this spins until it is finished.
+ *
+ * A typical read section looks like this::
+ *
+ *        unsigned long seq;
+ *
+ *        do {
+ *                seq = c_rbtree_seq_read_begin(st);
+ *                ...traverse st->tree...
+ *        } while (c_rbtree_seq_read_retry(st, seq));
+ *
+ * Return: The sequence number of this read section.
+ */
+static inline unsigned long c_rbtree_seq_read_begin(CRBSeqTree *st) {
+        unsigned long seq;
+
+        while ((seq = atomic_load_explicit(&st->__seq, memory_order_acquire)) & 1)
+                /* spin */ ;
+
+        return seq;
+}
+
+/**
+ * c_rbtree_seq_read_retry() - End a read section
+ * @st:         Tree to operate on
+ * @seq:        Sequence number returned by :c:func:`c_rbtree_seq_read_begin()`
+ *
+ * This ends a read section and checks whether it overlapped with a
+ * modification. If it did, any result of the read section must be discarded
+ * and the read section must be retried.
+ *
+ * Return: True if the read section must be retried, false otherwise.
+ */
+static inline _Bool c_rbtree_seq_read_retry(CRBSeqTree *st, unsigned long seq) {
+        /* order all tree accesses before the counter check */
+        atomic_thread_fence(memory_order_acquire);
+        return atomic_load_explicit(&st->__seq, memory_order_relaxed) != seq;
+}
+
+/**
+ * c_rbtree_seq_find_node() - Find node
+ * @st:         Tree to search through
+ * @f:          Comparison function
+ * @k:          Key to search for
+ *
+ * This is :c:func:`c_rbtree_find_node()` run in a read section, retrying
+ * until it did not overlap with a modification.
+ *
+ * Return: Pointer to matching node, or NULL.
+ */
+static inline CRBNode *c_rbtree_seq_find_node(CRBSeqTree *st, CRBCompareFunc f, const void *k) {
+        unsigned long seq;
+        CRBNode *n;
+
+        do {
+                seq = c_rbtree_seq_read_begin(st);
+                n = c_rbtree_find_node(&st->tree, f, k);
+        } while (c_rbtree_seq_read_retry(st, seq));
+
+        return n;
+}
+
+/**
+ * c_rbtree_seq_find_lower_bound() - Find lower bound
+ * @st:         Tree to search through
+ * @f:          Comparison function
+ * @k:          Key to search for
+ *
+ * This is :c:func:`c_rbtree_find_lower_bound()` run in a read section,
+ * retrying until it did not overlap with a modification. Iterating a tree
+ * without a lock can be done by repeatedly searching for the lower bound of
+ * the successor of the last key.
+ *
+ * Return: Pointer to lower bound, or NULL.
+ */
+static inline CRBNode *c_rbtree_seq_find_lower_bound(CRBSeqTree *st, CRBCompareFunc f, const void *k) {
+        unsigned long seq;
+        CRBNode *n;
+
+        do {
+                seq = c_rbtree_seq_read_begin(st);
+                n = c_rbtree_find_lower_bound(&st->tree, f, k);
+        } while (c_rbtree_seq_read_retry(st, seq));
+
+        return n;
+}
+
+/**
+ * c_rbtree_seq_next() - Return next node
+ * @st:         Tree to operate on
+ * @n:          Current node, or NULL
+ * @seq:        Sequence number of the read section ``n`` was found in
+ *
+ * This is :c:func:`c_rbnode_next()` validated against a read section. If no
+ * modification happened since ``seq`` was sampled, the next node is returned
+ * and the read section stays valid. Otherwise, NULL is returned and ``seq``
+ * is updated to a new read section. The caller must then restart from a
+ * lookup (e.g., :c:func:`c_rbtree_seq_find_lower_bound()` on the last key).
+ *
+ * Return: Pointer to next node, or NULL if at the end or on conflict.
+ */
+static inline CRBNode *c_rbtree_seq_next(CRBSeqTree *st, CRBNode *n, unsigned long *seq) {
+        CRBNode *next;
+
+        next = c_rbnode_next(n);
+        if (c_rbtree_seq_read_retry(st, *seq)) {
+                *seq = c_rbtree_seq_read_begin(st);
+                return NULL;
+        }
+
+        return next;
+}
+
+/**
+ * DOC: Epoch-Based Reclamation
+ *
+ * Lockless readers might still access a node after the writer unlinked it.
+ * Hence, the writer cannot release the memory of a node right after it
+ * unlinked it. A :c:struct:`CRBEpoch` object tracks which readers might still
+ * access unlinked nodes, and defers their release until no reader can reach
+ * them anymore.
+ *
+ * The caller provides one :c:struct:`CRBEpochReader` slot for each reader
+ * thread. Readers wrap their lookups in
+ * :c:func:`c_rbtree_epoch_read_begin()` and
+ * :c:func:`c_rbtree_epoch_read_end()`. Those only touch the reader slot and
+ * never block. The writer unlinks nodes via
+ * :c:func:`c_rbtree_epoch_unlink()` and then regularly calls
+ * :c:func:`c_rbtree_epoch_reclaim()` to release all entries that no reader
+ * can reach anymore, in batches. Each unlinked node needs a
+ * :c:struct:`CRBEpochEntry` embedded next to it, which tracks the node until it
+ * is released.
+ *
+ * This only provides memory safety for lockless readers. To get correct
+ * lookup results, readers must still synchronize with the writer, for
+ * instance by combining this with a :c:struct:`CRBSeqTree`.
+ *
+ * All writer-side functions must be serialized by the caller. A single reader
+ * slot must only be used by one thread at a time, and read sections must not
+ * be nested.
+ */
+/**/
+
+/**
+ * struct CRBEpochReader - Reader slot of an epoch
+ *
+ * Each reader of a :c:struct:`CRBEpoch` object needs its own reader slot. It
+ * is aligned to a cache line, so readers do not contend with each other.
+ *
+ * To initialize, set it to all zero.
+ */
+struct CRBEpochReader {
+        /* Epoch of the current read section, or 0 if not in one */
+        alignas(64) atomic_ulong __epoch;
+};
+
+/**
+ * struct CRBEpochEntry - Retired entry
+ *
+ * An epoch entry tracks an unlinked node until it can be released. It must
+ * be embedded in the same object as the node. Its content is private to the
+ * epoch implementation.
+ */
+struct CRBEpochEntry {
+        CRBEpochEntry *__next;
+        unsigned long __epoch;
+};
+
+/**
+ * struct CRBEpoch - Epoch-based reclamation
+ *
+ * This tracks the reader slots and the retired entries of an epoch. Use
+ * :c:func:`c_rbtree_epoch_init()` to initialize it. Its content is private to
+ * the epoch implementation.
+ */
+struct CRBEpoch {
+        atomic_ulong __epoch;
+        CRBEpochReader *__readers;
+        size_t __n_readers;
+        CRBEpochEntry *__retired;
+        CRBEpochEntry **__retired_tail;
+};
+
+/**
+ * c_rbtree_epoch_init() - Initialize epoch
+ * @e:          Epoch to operate on
+ * @readers:    Array of reader slots
+ * @n_readers:  Number of reader slots
+ *
+ * This initializes a new epoch object. The reader slots must be initialized
+ * by the caller and must stay valid for the lifetime of the epoch.
+ */
+static inline void c_rbtree_epoch_init(CRBEpoch *e, CRBEpochReader *readers, size_t n_readers) {
+        atomic_init(&e->__epoch, 1);
+        e->__readers = readers;
+        e->__n_readers = n_readers;
+        e->__retired = NULL;
+        e->__retired_tail = &e->__retired;
+}
+
+/**
+ * c_rbtree_epoch_read_begin() - Begin a read section
+ * @e:          Epoch to operate on
+ * @r:          Reader slot of the calling thread
+ *
+ * This starts a read section on the given reader slot. Until the read section
+ * is ended via :c:func:`c_rbtree_epoch_read_end()`, no node unlinked by the
+ * writer after this call started will be released.
+ */
+static inline void c_rbtree_epoch_read_begin(CRBEpoch *e, CRBEpochReader *r) {
+        unsigned long epoch = atomic_load_explicit(&e->__epoch, memory_order_relaxed);
+
+        assert(!atomic_load_explicit(&r->__epoch, memory_order_relaxed));
+
+        atomic_store_explicit(&r->__epoch, epoch, memory_order_relaxed);
+        /*
+         * Order the slot update before any tree access. This pairs with the
+         * fence in c_rbtree_epoch_reclaim(): either the writer sees this
+         * reader as active, or this reader sees all previous unlinks.
+         */
+        atomic_thread_fence(memory_order_seq_cst);
+}
+
+/**
+ * c_rbtree_epoch_read_end() - End a read section
+ * @r:          Reader slot of the calling thread
+ *
+ * This ends a read section started via :c:func:`c_rbtree_epoch_read_begin()`.
+ * No node must be accessed after this, unless it was pinned by other means.
+ */
+static inline void c_rbtree_epoch_read_end(CRBEpochReader *r) {
+        assert(atomic_load_explicit(&r->__epoch, memory_order_relaxed));
+
+        /* order all tree accesses before the slot update */
+        atomic_store_explicit(&r->__epoch, 0, memory_order_release);
+}
+
+/**
+ * c_rbtree_epoch_retire() - Retire entry
+ * @e:          Epoch to operate on
+ * @entry:      Entry to retire
+ *
+ * This queues ``entry`` for release. The entry must belong to a node that was
+ * already unlinked from its tree. It will be passed to the release callback
+ * of :c:func:`c_rbtree_epoch_reclaim()` once no reader can reach it anymore.
+ */
+static inline void c_rbtree_epoch_retire(CRBEpoch *e, CRBEpochEntry *entry) {
+        entry->__next = NULL;
+        entry->__epoch = atomic_load_explicit(&e->__epoch, memory_order_relaxed);
+        *e->__retired_tail = entry;
+        e->__retired_tail = &entry->__next;
+}
+
+/**
+ * c_rbtree_epoch_unlink() - Unlink node and retire it
+ * @e:          Epoch to operate on
+ * @n:          Node to unlink
+ * @entry:      Entry embedded next to ``n``
+ *
+ * This unlinks ``n`` from its tree via :c:func:`c_rbnode_unlink_stale()` and
+ * retires ``entry``. The node is left untouched, so lockless readers
+ * currently on the node can continue their traversal.
+ */
+static inline void c_rbtree_epoch_unlink(CRBEpoch *e, CRBNode *n, CRBEpochEntry *entry) {
+        c_rbnode_unlink_stale(n);
+        c_rbtree_epoch_retire(e, entry);
+}
+
+/**
+ * c_rbtree_epoch_reclaim() - Release unreachable entries
+ * @e:          Epoch to operate on
+ * @f:          Release callback
+ * @userdata:   Userdata to pass to ``f``
+ *
+ * This advances the epoch and then calls ``f`` on all retired entries that no
+ * reader can reach anymore, in the order they were retired. Entries that might
+ * still be reached by a reader stay queued for a later call.
+ *
+ * Runtime is linear in the number of reader slots and released entries.
+ *
+ * Return: Number of released entries.
+ */
+static inline size_t c_rbtree_epoch_reclaim(CRBEpoch *e, CRBEpochFreeFunc f, void *userdata) {
+        unsigned long epoch, v;
+        CRBEpochEntry *entry;
+        size_t i, n = 0;
+
+        /*
+         * Readers that start after this can no longer reach any retired
+         * entry. The fence orders all previous unlinks before the slot loads
+         * below. It pairs with the fence in c_rbtree_epoch_read_begin().
+         */
+        epoch = atomic_fetch_add_explicit(&e->__epoch, 1, memory_order_seq_cst) + 1;
+        atomic_thread_fence(memory_order_seq_cst);
+
+        for (i = 0; i < e->__n_readers; ++i) {
+                v = atomic_load_explicit(&e->__readers[i].__epoch, memory_order_acquire);
+                if (v && v < epoch)
+                        epoch = v;
+        }
+
+        /* release everything retired before the oldest active read section */
+        while ((entry = e->__retired) && entry->__epoch < epoch) {
+                e->__retired = entry->__next;
+                if (!e->__retired)
+                        e->__retired_tail = &e->__retired;
+
+                f(entry, userdata);
+                ++n;
+        }
+
+        return n;
+}
+
+/**
+ * c_rbtree_epoch_has_retired() - Check whether an epoch has retired entries
+ * @e:          Epoch to check
+ *
+ * Return: True if retired entries are pending release, false otherwise.
+ */
+static inline _Bool c_rbtree_epoch_has_retired(CRBEpoch *e) {
+        return !!e->__retired;
+}
+
+/**
+ * DOC: Hazard Pointers
+ *
+ * With epoch-based reclamation, a single stalled reader prevents any retired
+ * node from being released. As an alternative, a :c:struct:`CRBHazard` object
+ * protects individual nodes via hazard pointers. Each reader publishes the
+ * nodes it currently accesses in its :c:struct:`CRBHazardReader` slot, and the
+ * writer only releases retired nodes that are not published by any reader.
+ * Hence, a stalled reader pins at most two nodes, and the number of retired but
+ * unreleased nodes is bounded by twice the number of readers.
+ *
+ * Readers traverse the tree hand-over-hand via
+ * :c:func:`c_rbtree_hazard_find_node()`,
+ * :c:func:`c_rbtree_hazard_find_lower_bound()`, and
+ * :c:func:`c_rbtree_hazard_next()`. Each step publishes the next node and then
+ * verifies it is still linked where it was found. If not, the traversal is
+ * restarted (or, for iterations, aborted). The returned node stays protected
+ * until the next call on the same reader slot, or until
+ * :c:func:`c_rbtree_hazard_release()` is called.
+ *
+ * The writer unlinks nodes via :c:func:`c_rbtree_hazard_unlink()`, which marks
+ * them as unlinked without touching their child pointers, and releases them via
+ * :c:func:`c_rbtree_hazard_reclaim()`. All writer-side functions must be
+ * serialized by the caller.
+ *
+ * Like all lockless lookups, hazard-protected lookups can miss nodes if they
+ * race a rebalancing operation. Combine them with a :c:struct:`CRBSeqTree` to
+ * get correct results. Furthermore, lockless readers require the library to
+ * be built with lockless readers enabled (which is the default).
+ */
+/**/
+
+/**
+ * struct CRBHazardReader - Reader slot of hazard pointers
+ *
+ * Each reader of a :c:struct:`CRBHazard` object needs its own reader slot. It
+ * is aligned to a cache line, so readers do not contend with each other.
+ *
+ * To initialize, set it to all zero.
+ */
+struct CRBHazardReader {
+        /* Published nodes, used alternately during traversals */
+        alignas(64) CRBNode *_Atomic __slots[2];
+        /* Index of the slot protecting the current node */
+        unsigned int __current;
+};
+
+/**
+ * struct CRBHazardEntry - Retired entry
+ *
+ * A hazard entry tracks an unlinked node until it can be released. It must be
+ * embedded in the same object as the node. Its content is private to the
+ * hazard pointer implementation.
+ */
+struct CRBHazardEntry {
+        CRBHazardEntry *__next;
+        CRBNode *__node;
+};
+
+/**
+ * struct CRBHazard - Hazard pointer reclamation
+ *
+ * This tracks the reader slots and the retired entries of a set of hazard
+ * pointers. Use :c:func:`c_rbtree_hazard_init()` to initialize it. Its content
+ * is private to the hazard pointer implementation.
+ */
+struct CRBHazard {
+        CRBHazardReader *__readers;
+        size_t __n_readers;
+        CRBHazardEntry *__retired;
+        size_t __n_retired;
+};
+
+/**
+ * c_rbtree_hazard_init() - Initialize hazard pointers
+ * @h:          Hazard pointers to operate on
+ * @readers:    Array of reader slots
+ * @n_readers:  Number of reader slots
+ *
+ * This initializes a new hazard pointer object. The reader slots must be
+ * initialized by the caller and must stay valid for the lifetime of the
+ * object.
+ */
+static inline void c_rbtree_hazard_init(CRBHazard *h, CRBHazardReader *readers, size_t n_readers) {
+        h->__readers = readers;
+        h->__n_readers = n_readers;
+        h->__retired = NULL;
+        h->__n_retired = 0;
+}
+
+/* implementation detail */
+static inline CRBNode *c_rbtree_hazard_load(CRBNode **ptr) {
+        /* pairs with the release-stores of c_rbtree_store() */
+        return atomic_load_explicit((CRBNode *_Atomic *)ptr, memory_order_acquire);
+}
+
+/* implementation detail */
+static inline _Bool c_rbtree_hazard_protect(CRBHazardReader *r, CRBTree *t, CRBNode *p, CRBNode *n) {
+        unsigned int slot = r->__current ^ 1;
+        unsigned long v;
+
+        atomic_store_explicit(&r->__slots[slot], n, memory_order_relaxed);
+        /* order the publication before the validation; pairs with reclaim */
+        atomic_thread_fence(memory_order_seq_cst);
+
+        /* @n must still be linked where we found it */
+        if (p) {
+                v = atomic_load_explicit((_Atomic unsigned long *)&p->__parent_and_flags,
+                                         memory_order_relaxed);
+                if ((CRBNode *)(v & ~C_RBNODE_FLAG_MASK) == p)
+                        return 0;
+                if (c_rbtree_hazard_load(&p->left) != n && c_rbtree_hazard_load(&p->right) != n)
+                        return 0;
+        } else if (c_rbtree_hazard_load(&t->root) != n) {
+                return 0;
+        }
+
+        atomic_store_explicit(&r->__slots[slot ^ 1], NULL, memory_order_release);
+        r->__current = slot;
+        return 1;
+}
+
+/* implementation detail */
+static inline int c_rbtree_hazard_protect_parent(CRBHazardReader *r, CRBNode *n) {
+        unsigned int slot = r->__current ^ 1;
+        unsigned long v;
+        CRBNode *p;
+
+        v = atomic_load_explicit((_Atomic unsigned long *)&n->__parent_and_flags, memory_order_acquire);
+        if (v & C_RBNODE_ROOT)
+                return 0;
+
+        p = (CRBNode *)(v & ~C_RBNODE_FLAG_MASK);
+        if (p == n)
+                return -1;
+
+        atomic_store_explicit(&r->__slots[slot], p, memory_order_relaxed);
+        /* order the publication before the validation; pairs with reclaim */
+        atomic_thread_fence(memory_order_seq_cst);
+
+        /* @n must still be linked below @p (its color might have changed) */
+        v = atomic_load_explicit((_Atomic unsigned long *)&n->__parent_and_flags, memory_order_relaxed);
+        if ((v & C_RBNODE_ROOT) || (CRBNode *)(v & ~C_RBNODE_FLAG_MASK) != p)
+                return -1;
+
+        atomic_store_explicit(&r->__slots[slot ^ 1], NULL, memory_order_release);
+        r->__current = slot;
+        return 1;
+}
+
+/**
+ * c_rbtree_hazard_release() - Release protected nodes
+ * @r:          Reader slot of the calling thread
+ *
+ * This clears all hazard pointers of the reader slot. Nodes returned by
+ * previous lookups must not be accessed afterwards.
+ */
+static inline void c_rbtree_hazard_release(CRBHazardReader *r) {
+        atomic_store_explicit(&r->__slots[0], NULL, memory_order_release);
+        atomic_store_explicit(&r->__slots[1], NULL, memory_order_release);
+}
+
+/**
+ * c_rbtree_hazard_find_node() - Find node
+ * @r:          Reader slot of the calling thread
+ * @t:          Tree to search through
+ * @f:          Comparison function
+ * @k:          Key to search for
+ *
+ * This is :c:func:`c_rbtree_find_node()` with hazard-pointer protection. Any
+ * node protected by ``r`` before this call is released. The returned node is
+ * protected until the next call on ``r``.
+ *
+ * Return: Pointer to matching node, or NULL.
+ */
+static inline CRBNode *c_rbtree_hazard_find_node(CRBHazardReader *r, CRBTree *t, CRBCompareFunc f, const void *k) {
+        CRBNode *i, *p;
+        int v;
+
+retry:
+        for (p = NULL, i = c_rbtree_hazard_load(&t->root); i; p = i, i = (v < 0) ?
+                        c_rbtree_hazard_load(&i->left) : c_rbtree_hazard_load(&i->right)) {
+                if (!c_rbtree_hazard_protect(r, t, p, i))
+                        goto retry;
+
+                v = f(t, (void *)k, i);
+                if (!v)
+                        return i;
+        }
+
+        c_rbtree_hazard_release(r);
+        return NULL;
+}
+
+/**
+ * c_rbtree_hazard_next() - Return next node
+ * @r:          Reader slot of the calling thread
+ * @t:          Tree to operate on
+ * @n:          Current node, protected by ``r``
+ *
+ * This is :c:func:`c_rbnode_next()` with hazard-pointer protection. ``n`` must
+ * be the node returned by the last lookup on ``r``. It is released, and the
+ * returned node is protected until the next call on ``r``.
+ *
+ * If ``n`` was unlinked, or the tree was modified around it, the iteration
+ * cannot continue and NULL is returned. The caller must then restart from a
+ * lookup (e.g., :c:func:`c_rbtree_hazard_find_lower_bound()` on the successor
+ * of the last key), which returns NULL as well if the end was reached.
+ *
+ * Return: Pointer to next node, or NULL if at the end or on conflict.
+ */
+static inline CRBNode *c_rbtree_hazard_next(CRBHazardReader *r, CRBTree *t, CRBNode *n) {
+        CRBNode *i;
+        int v;
+
+        i = c_rbtree_hazard_load(&n->right);
+        if (i) {
+                if (!c_rbtree_hazard_protect(r, t, n, i))
+                        goto error;
+
+                for (n = i; (i = c_rbtree_hazard_load(&n->left)); n = i)
+                        if (!c_rbtree_hazard_protect(r, t, n, i))
+                                goto error;
+
+                return n;
+        }
+
+        while ((v = c_rbtree_hazard_protect_parent(r, n)) > 0) {
+                i = atomic_load_explicit(&r->__slots[r->__current], memory_order_relaxed);
+                if (c_rbtree_hazard_load(&i->right) != n)
+                        return i;
+
+                n = i;
+        }
+
+error:
+        c_rbtree_hazard_release(r);
+        return NULL;
+}
+
+/**
+ * c_rbtree_hazard_find_lower_bound() - Find lower bound
+ * @r:          Reader slot of the calling thread
+ * @t:          Tree to search through
+ * @f:          Comparison function
+ * @k:          Key to search for
+ *
+ * This is :c:func:`c_rbtree_find_lower_bound()` with hazard-pointer
+ * protection. Any node protected by ``r`` before this call is released. The
+ * returned node is protected until the next call on ``r``.
+ *
+ * Return: Pointer to lower bound, or NULL.
+ */
+static inline CRBNode *c_rbtree_hazard_find_lower_bound(CRBHazardReader *r, CRBTree *t, CRBCompareFunc f, const void *k) {
+        CRBNode *i, *p;
+        _Bool found;
+        int v;
+
+retry:
+        found = 0;
+        for (p = NULL, i = c_rbtree_hazard_load(&t->root); i; p = i, i = (v > 0) ?
+                        c_rbtree_hazard_load(&i->right) : c_rbtree_hazard_load(&i->left)) {
+                if (!c_rbtree_hazard_protect(r, t, p, i))
+                        goto retry;
+
+                v = f(t, (void *)k, i);
+                if (v <= 0)
+                        found = 1;
+        }
+
+        if (!found) {
+                c_rbtree_hazard_release(r);
+                return NULL;
+        }
+
+        /*
+         * Only the last node is still protected. If it orders before @k, the
+         * lower bound is its successor (it has no right child).
+         */
+        if (v > 0) {
+                p = c_rbtree_hazard_next(r, t, p);
+                if (!p)
+                        goto retry;
+        }
+
+        return p;
+}
+
+/**
+ * c_rbtree_hazard_unlink() - Unlink node and retire it
+ * @h:          Hazard pointers to operate on
+ * @n:          Node to unlink
+ * @entry:      Entry embedded next to ``n``
+ *
+ * This unlinks ``n`` from its tree via :c:func:`c_rbnode_unlink_stale()`, marks
+ * it as unlinked, and retires ``entry``. The child pointers of ``n`` are left
+ * untouched, so lockless readers currently on the node can continue their
+ * traversal. However, hazard-protected traversals will notice the node was
+ * unlinked and restart.
+ */
+static inline void c_rbtree_hazard_unlink(CRBHazard *h, CRBNode *n, CRBHazardEntry *entry) {
+        c_rbnode_unlink_stale(n);
+        atomic_store_explicit((_Atomic unsigned long *)&n->__parent_and_flags,
+                              (unsigned long)n, memory_order_release);
+
+        entry->__node = n;
+        entry->__next = h->__retired;
+        h->__retired = entry;
+        ++h->__n_retired;
+}
+
+/**
+ * c_rbtree_hazard_reclaim() - Release unprotected entries
+ * @h:          Hazard pointers to operate on
+ * @f:          Release callback
+ * @userdata:   Userdata to pass to ``f``
+ *
+ * This calls ``f`` on all retired entries whose node is not protected by any
+ * reader. All other entries stay queued for a later call. Afterwards, at most
+ * twice the number of reader slots entries are left queued.
+ *
+ * Runtime is linear in the number of retired entries times the number of
+ * reader slots.
+ *
+ * Return: Number of released entries.
+ */
+static inline size_t c_rbtree_hazard_reclaim(CRBHazard *h, CRBHazardFreeFunc f, void *userdata) {
+        CRBHazardEntry *entry, **next;
+        CRBNode *node;
+        size_t i, n = 0;
+
+        /*
+         * Order all previous unlinks before the slot loads below. Either a
+         * reader published its node early enough for us to see it, or it sees
+         * the node as unlinked in its validation. This pairs with the fence in
+         * c_rbtree_hazard_protect().
+         */
+        atomic_thread_fence(memory_order_seq_cst);
+
+        next = &h->__retired;
+        while ((entry = *next)) {
+                node = entry->__node;
+
+                for (i = 0; i < h->__n_readers; ++i)
+                        if (atomic_load_explicit(&h->__readers[i].__slots[0], memory_order_acquire) == node ||
+                            atomic_load_explicit(&h->__readers[i].__slots[1], memory_order_acquire) == node)
+                                break;
+
+                if (i < h->__n_readers) {
+                        next = &entry->__next;
+                } else {
+                        *next = entry->__next;
+                        --h->__n_retired;
+                        f(entry, userdata);
+                        ++n;
+                }
+        }
+
+        return n;
+}
+
+/**
+ * c_rbtree_hazard_n_retired() - Return number of retired entries
+ * @h:          Hazard pointers to query
+ *
+ * Return: Number of retired entries that were not released, yet.
+ */
+static inline size_t c_rbtree_hazard_n_retired(CRBHazard *h) {
+        return h->__n_retired;
+}
+
+#ifdef __cplusplus
+}
+#endif
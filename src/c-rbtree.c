@@ -28,9 +28,25 @@
 #include <c-stdaux.h>
 #include <stdalign.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include "c-rbtree.h"
 #include "c-rbtree-private.h"
 
+/*
+ * By default, all tree modifications are ordered for lockless readers (see
+ * c_rbtree_store()). This can be disabled at build-time for users that never
+ * share a tree between threads, in which case plain stores are used and the
+ * compiler is free to reorder and merge them.
+ */
+#ifndef C_RBTREE_LOCKLESS
+#  define C_RBTREE_LOCKLESS 1
+#endif
+
+#if C_RBTREE_LOCKLESS
+#  include <stdatomic.h>
+#endif
+
 /*
  * We use the lower 2 bits of CRBNode pointers to store flags. Make sure
  * CRBNode is 4-byte aligned, so the lower 2 bits are actually unused. We also
@@ -388,16 +404,25 @@ _c_public_ CRBNode *c_rbtree_last_postorder(CRBTree *t) {
 
 static inline void c_rbtree_store(CRBNode **ptr, CRBNode *addr) {
         /*
-         * We use volatile accesses whenever we STORE left or right members
-         * of a node. This guarantees that any parallel, lockless lookup gets
-         * to see those stores in the correct order, which itself guarantees
-         * that there're no temporary loops during tree rotation.
-         * Note that you still need to properly synchronize your accesses via
-         * seqlocks, rcu, whatever. We just guarantee that you get *some*
-         * result on a lockless traversal and never run into endless loops, or
-         * undefined behavior.
+         * We use release-stores whenever we STORE left or right members of a
+         * node. This orders the stores of the writer (also on weakly ordered
+         * machines), so no link is published before the stores it depends
+         * on, and a rotation never creates a temporary loop.
+         * This is only the writer side, though. The generic lookup and
+         * iterator helpers read the links with plain loads, which is a data
+         * race under C11, and a release-store alone does not order them.
+         * Lockless readers thus only get results that are meaningful if they
+         * validate them via seqlocks, rcu, whatever (e.g., the retry of
+         * c-rbtree-sync.h).
+         *
+         * If lockless readers are disabled at build-time, this is a plain
+         * store.
          */
-        *(volatile CRBNode **)ptr = addr;
+#if C_RBTREE_LOCKLESS
+        atomic_store_explicit((CRBNode *_Atomic *)ptr, addr, memory_order_release);
+#else
+        *ptr = addr;
+#endif
 }
 
 /*
@@ -570,6 +595,10 @@ static inline void c_rbtree_paint_terminal(CRBNode *n) {
                  * the left child of the old grandparent, and we would still
                  * have a double red path. As the new grandparent remains
                  * black, we're done.
+                 *
+                 * The color of the sibling @x is retained. It is black,
+                 * unless it was linked via c_rbtree_add_relaxed() and still
+                 * awaits its own repaint.
                  */
                 x = p->right;
                 t = c_rbnode_pop_root(g);
@@ -577,7 +606,7 @@ static inline void c_rbtree_paint_terminal(CRBNode *n) {
                 c_rbtree_store(&p->right, g);
                 c_rbnode_swap_child(g, p);
                 if (x)
-                        c_rbnode_set_parent_and_flags(x, g, c_rbnode_flags(x) & ~C_RBNODE_RED);
+                        c_rbnode_set_parent_and_flags(x, g, c_rbnode_flags(x));
                 c_rbnode_set_parent_and_flags(p, gg, c_rbnode_flags(p) & ~C_RBNODE_RED);
                 c_rbnode_set_parent_and_flags(g, p, c_rbnode_flags(g) | C_RBNODE_RED);
                 c_rbnode_push_root(p, t);
@@ -598,7 +627,7 @@ static inline void c_rbtree_paint_terminal(CRBNode *n) {
                 c_rbtree_store(&p->left, g);
                 c_rbnode_swap_child(g, p);
                 if (x)
-                        c_rbnode_set_parent_and_flags(x, g, c_rbnode_flags(x) & ~C_RBNODE_RED);
+                        c_rbnode_set_parent_and_flags(x, g, c_rbnode_flags(x));
                 c_rbnode_set_parent_and_flags(p, gg, c_rbnode_flags(p) & ~C_RBNODE_RED);
                 c_rbnode_set_parent_and_flags(g, p, c_rbnode_flags(g) | C_RBNODE_RED);
                 c_rbnode_push_root(p, t);
@@ -805,6 +834,238 @@ _c_public_ void c_rbtree_add(CRBTree *t, CRBNode *p, CRBNode **l, CRBNode *n) {
         c_rbtree_paint(n);
 }
 
+/**
+ * c_rbtree_add_relaxed() - Add node to tree without rebalancing
+ * @t:          Tree to operate on
+ * @p:          Parent node to link under, or NULL
+ * @l:          Left/right slot of @p (or root) to link at
+ * @n:          Node to add
+ *
+ * This is the same as :c:func:`c_rbtree_add()`, but it only links the node
+ * and defers rebalancing to the caller. The node is linked red, so the number
+ * of black nodes on each path is retained. If its parent is black, the tree is
+ * still balanced and nothing else is to be done. Otherwise, the node violates
+ * the RB-Tree invariants, and the caller must pass it to
+ * :c:func:`c_rbnode_repaint()` later on. Pending nodes can be repainted in any
+ * order, and at any time. This allows moving the rebalancing off the
+ * latency-critical path, and running it in bounded steps (e.g., a few nodes
+ * per iteration of an event loop), or once too many nodes are pending.
+ *
+ * While nodes are pending, the tree must not be modified other than via this
+ * function and :c:func:`c_rbnode_repaint()`. Lookups and iterations are fine,
+ * but each pending node can add one layer to the tree. That is, with ``k``
+ * pending nodes, the depth of a tree with ``n`` nodes is bounded by
+ * ``2 * log2(n + 1) + k``. Hence, callers can bound the depth by repainting
+ * all pending nodes once their number exceeds a threshold.
+ *
+ * Worst case runtime: O(1)
+ *
+ * Return: True if ``n`` must be repainted, false if not.
+ */
+_c_public_ _Bool c_rbtree_add_relaxed(CRBTree *t, CRBNode *p, CRBNode **l, CRBNode *n) {
+        c_assert(t);
+        c_assert(l);
+        c_assert(n);
+        c_assert(!p || l == &p->left || l == &p->right);
+        c_assert(p || l == &t->root);
+
+        c_rbnode_set_parent_and_flags(n, p, C_RBNODE_RED);
+        c_rbtree_store(&n->left, NULL);
+        c_rbtree_store(&n->right, NULL);
+
+        if (p) {
+                c_rbtree_store(l, n);
+                return c_rbnode_is_red(p);
+        }
+
+        c_rbnode_push_root(n, t);
+        c_rbnode_set_parent_and_flags(n, c_rbnode_raw(n), c_rbnode_flags(n) & ~C_RBNODE_RED);
+        return false;
+}
+
+static void c_rbnode_repaint_path(CRBNode *n, size_t depth) {
+        CRBNode *i, *p, *v;
+        size_t j;
+
+        /*
+         * This repaints all violations among @n and its first @depth - 1
+         * ancestors, while the path above them must be valid.
+         *
+         * c_rbtree_paint() can fix a single violation (i.e., a red node with
+         * a red parent), but requires the path above it to be valid. Hence,
+         * violations must be repainted from the top down. Repainting a
+         * violation recolors its ancestors and rotates it with its parent and
+         * grandparent, but leaves the sub-tree of its child on the path
+         * untouched. So, afterwards, all remaining violations are still
+         * within that sub-tree, and the path above them is valid again.
+         *
+         * Nodes do not link to the child on the path, so we cannot walk down
+         * the path. Instead, we split the path in halves and repaint the upper
+         * half first, recursing on each. This walks each layer of the
+         * recursion once, and the recursion depth is O(log(@depth)). Short
+         * paths are simply rescanned after each repaint.
+         */
+        if (depth > 8) {
+                for (i = n, j = 0; j < depth / 2; ++j)
+                        i = c_rbnode_parent(i);
+
+                c_rbnode_repaint_path(i, depth - depth / 2);
+                c_rbnode_repaint_path(n, depth / 2);
+                return;
+        }
+
+        for (;;) {
+                v = NULL;
+                for (i = n, j = 0; j < depth && (p = c_rbnode_parent(i)); i = p, ++j)
+                        if (c_rbnode_is_red(i) && c_rbnode_is_red(p))
+                                v = i;
+
+                if (!v)
+                        break;
+
+                c_rbtree_paint(v);
+        }
+}
+
+/**
+ * c_rbnode_repaint() - Rebalance tree after relaxed insertion
+ * @n:          Node to repaint, or NULL
+ *
+ * This restores the RB-Tree invariants on the path from ``n`` to the root of
+ * its tree. ``n`` must have been linked via :c:func:`c_rbtree_add_relaxed()`.
+ * Once all nodes that were reported as pending by that function are
+ * repainted, the tree is a valid RB-Tree again.
+ *
+ * If ``n`` is NULL, unlinked, or the path was already restored as a
+ * side-effect of repainting other nodes, this is a no-op.
+ *
+ * Worst case runtime (d: depth of the node): O(d log(d))
+ */
+_c_public_ void c_rbnode_repaint(CRBNode *n) {
+        CRBNode *i, *p;
+        size_t j, depth = 0;
+
+        if (!n || !c_rbnode_is_linked(n))
+                return;
+
+        /*
+         * Find the top-most violation on the path to the root. Repainting
+         * never makes a node a violation that was not one before, so every
+         * violation above it is still pending on its own node, and the path
+         * above the top-most violation is valid.
+         */
+        for (i = n, j = 1; (p = c_rbnode_parent(i)); i = p, ++j)
+                if (c_rbnode_is_red(i) && c_rbnode_is_red(p))
+                        depth = j;
+
+        if (depth)
+                c_rbnode_repaint_path(n, depth);
+}
+
+/**
+ * c_rbnode_reposition() - Move node after its key changed
+ * @t:          Tree to operate on
+ * @n:          Node to reposition
+ * @f:          Comparison function
+ * @k:          New key of the node
+ *
+ * This moves the linked node ``n`` to the position of its new key ``k``. The
+ * caller is free to update the key of the entry before or after calling this,
+ * since ``n`` is never compared against.
+ *
+ * If ``k`` still orders between the neighbors of ``n``, the node is left in
+ * place and the tree is not modified at all. Otherwise, the node is unlinked
+ * and linked again. The new slot is searched for starting at the neighbor in
+ * the direction of the move, rather than at the root, so small moves only
+ * touch a small sub-tree.
+ *
+ * If ``k`` compares equal to another node in the tree, ``n`` is unlinked and
+ * reinitialized, and the conflicting node is returned.
+ *
+ * Worst case runtime (n: number of elements in tree, d: distance of the move
+ * in number of nodes): O(log(n)), or O(log(d)) for the search alone.
+ *
+ * Return: NULL on success, or pointer to the conflicting node.
+ */
+_c_public_ CRBNode *c_rbnode_reposition(CRBTree *t, CRBNode *n, CRBCompareFunc f, const void *k) {
+        CRBNode *prev, *next, *i, *p, *q, **slot;
+        int v;
+
+        c_assert(t);
+        c_assert(c_rbnode_is_linked(n));
+        c_assert(f);
+
+        prev = c_rbnode_prev(n);
+        next = c_rbnode_next(n);
+
+        /*
+         * If the key still orders between the neighbors, the position is
+         * still valid. This is the common case for small updates, and is
+         * checked without touching the tree. Otherwise, pick the neighbor in
+         * the direction of the move as finger, so we can start the search
+         * there after the node was unlinked.
+         */
+        v = prev ? f(t, (void *)k, prev) : 1;
+        if (v > 0) {
+                v = next ? f(t, (void *)k, next) : -1;
+                if (v < 0)
+                        return NULL;
+
+                i = next;
+        } else {
+                i = prev;
+        }
+
+        c_rbnode_unlink_stale(n);
+
+        if (!v) {
+                c_rbnode_init(n);
+                return i;
+        }
+
+        /*
+         * Climb up from the finger until we reach a child on the near side
+         * whose parent orders on the far side of the key. The slot of the
+         * node is within the sub-tree of that child. If there is none, we end
+         * up at the root.
+         */
+        if (v > 0) {
+                while ((q = c_rbnode_parent(i))) {
+                        if (i == q->left && f(t, (void *)k, q) < 0)
+                                break;
+                        i = q;
+                }
+        } else {
+                while ((q = c_rbnode_parent(i))) {
+                        if (i == q->right && f(t, (void *)k, q) > 0)
+                                break;
+                        i = q;
+                }
+        }
+
+        p = NULL;
+        slot = &t->root;
+        while (i) {
+                v = f(t, (void *)k, i);
+                p = i;
+                if (v < 0)
+                        slot = &i->left;
+                else if (v > 0)
+                        slot = &i->right;
+                else
+                        break;
+                i = *slot;
+        }
+
+        if (i) {
+                c_rbnode_init(n);
+                return i;
+        }
+
+        c_rbtree_add(t, p, slot, n);
+        return NULL;
+}
+
 static inline void c_rbnode_rebalance_terminal(CRBNode *p, CRBNode *previous) {
         CRBNode *s, *x, *y, *g;
         CRBTree *t;
@@ -1164,3 +1425,1161 @@ _c_public_ void c_rbnode_unlink_stale(CRBNode *n) {
                         c_rbnode_rebalance(next);
         }
 }
+
+/**
+ * c_rbnode_replace() - Replace node with another one
+ * @old:        Linked node to replace
+ * @n:          Unlinked node to put in place of ``old``
+ *
+ * This links ``n`` into the exact position of ``old``, inheriting its
+ * parent, children, and color. ``old`` is removed from the tree. The caller
+ * must guarantee that ``n`` orders the same as ``old``. Since the shape of
+ * the tree is not changed, no lookup or rebalancing is needed.
+ *
+ * ``n`` is fully initialized before it is published, so lockless readers
+ * either see ``old`` or ``n``, but never a partially linked node. Like with
+ * :c:func:`c_rbnode_unlink_stale()`, ``old`` is not reset, so readers that
+ * currently visit it can continue their traversal. Use
+ * :c:func:`c_rbnode_init()` to reset it, once no reader can access it anymore.
+ *
+ * Worst case runtime: O(1)
+ */
+_c_public_ void c_rbnode_replace(CRBNode *old, CRBNode *n) {
+        CRBNode *l, *r;
+        CRBTree *t;
+
+        c_assert(old);
+        c_assert(n);
+        c_assert(c_rbnode_is_linked(old));
+
+        if (old == n)
+                return;
+
+        l = old->left;
+        r = old->right;
+
+        n->__parent_and_flags = old->__parent_and_flags;
+        c_rbtree_store(&n->left, l);
+        c_rbtree_store(&n->right, r);
+
+        /*
+         * Publish @n via its parent (or the tree root) first, so it is
+         * reachable from the top only once it is fully initialized. The
+         * parent pointers of the children are updated last. Until then,
+         * upwards traversals from the children still pass through @old, which
+         * retains all its links.
+         */
+        if (c_rbnode_is_root(old)) {
+                t = c_rbnode_raw(old);
+                c_rbnode_push_root(n, t);
+        } else {
+                c_rbnode_swap_child(old, n);
+        }
+
+        if (l)
+                c_rbnode_set_parent_and_flags(l, n, c_rbnode_flags(l));
+        if (r)
+                c_rbnode_set_parent_and_flags(r, n, c_rbnode_flags(r));
+}
+
+/**
+ * DOC: Tree Rebuilding
+ *
+ * An RB-Tree only guarantees that no path is more than twice as long as any
+ * other path. After long sequences of insertions and removals, the tree can
+ * thus be considerably higher than necessary. The following helpers rebuild
+ * the tree in place, without any memory allocation, to tighten its shape.
+ */
+/**/
+
+/*
+ * Thread all nodes of @t into a singly-linked list in ascending order, using
+ * the right-pointers as links. This traverses the tree in reverse order, and
+ * only ever modifies the right-pointer of nodes that were already visited.
+ * c_rbnode_prev() never reads those, so the traversal stays intact.
+ *
+ * The tree is left in an inconsistent state and must be rebuilt from the list.
+ */
+static CRBNode *c_rbtree_flatten(CRBTree *t, size_t *n_nodesp) {
+        CRBNode *n, *prev, *list = NULL;
+        size_t n_nodes = 0;
+
+        for (n = c_rbtree_last(t); n; n = prev) {
+                prev = c_rbnode_prev(n);
+                c_rbtree_store(&n->right, list);
+                list = n;
+                ++n_nodes;
+        }
+
+        *n_nodesp = n_nodes;
+        return list;
+}
+
+/*
+ * Build a balanced tree from the first @n_nodes entries of @list, and advance
+ * @list past them. Both sub-trees of each node differ in size by at most one,
+ * so all leaves are at @red_depth or one layer deeper. Nodes at @red_depth are
+ * painted red, everything else black, which retains a uniform black-height.
+ * The parent pointer of the returned node is left unset.
+ */
+static CRBNode *c_rbtree_build_list(CRBNode **list, size_t n_nodes, size_t depth, size_t red_depth) {
+        CRBNode *n, *l, *r;
+
+        if (!n_nodes)
+                return NULL;
+
+        /* recurses at most to the tree height, which is O(log(n)) */
+        l = c_rbtree_build_list(list, n_nodes / 2, depth + 1, red_depth);
+        n = *list;
+        *list = n->right;
+        r = c_rbtree_build_list(list, n_nodes - n_nodes / 2 - 1, depth + 1, red_depth);
+
+        c_rbnode_set_parent_and_flags(n, NULL, (depth == red_depth) ? C_RBNODE_RED : 0);
+        c_rbtree_store(&n->left, l);
+        c_rbtree_store(&n->right, r);
+        if (l)
+                c_rbnode_set_parent_and_flags(l, n, c_rbnode_flags(l));
+        if (r)
+                c_rbnode_set_parent_and_flags(r, n, c_rbnode_flags(r));
+
+        return n;
+}
+
+/*
+ * Build a balanced tree from the @n_nodes entries of @nodes, just like
+ * c_rbtree_build_list(). Indexing the array avoids threading the nodes into a
+ * list first, which would touch each node one more time.
+ */
+static CRBNode *c_rbtree_build_array(CRBNode **nodes, size_t n_nodes, size_t depth, size_t red_depth) {
+        CRBNode *n, *l, *r;
+
+        if (!n_nodes)
+                return NULL;
+
+        l = c_rbtree_build_array(nodes, n_nodes / 2, depth + 1, red_depth);
+        n = nodes[n_nodes / 2];
+        r = c_rbtree_build_array(nodes + n_nodes / 2 + 1, n_nodes - n_nodes / 2 - 1, depth + 1, red_depth);
+
+        c_rbnode_set_parent_and_flags(n, NULL, (depth == red_depth) ? C_RBNODE_RED : 0);
+        c_rbtree_store(&n->left, l);
+        c_rbtree_store(&n->right, r);
+        if (l)
+                c_rbnode_set_parent_and_flags(l, n, c_rbnode_flags(l));
+        if (r)
+                c_rbnode_set_parent_and_flags(r, n, c_rbnode_flags(r));
+
+        return n;
+}
+
+/*
+ * In a tree of minimal height with @n_nodes nodes, all layers above
+ * floor(log2(n + 1)) are complete, only the layer below might be partially
+ * filled, and will be painted red. This returns the depth of that layer.
+ */
+static size_t c_rbtree_red_depth(size_t n_nodes) {
+        size_t red_depth;
+
+        for (red_depth = 0; (n_nodes + 1) >> (red_depth + 1); ++red_depth)
+                /* empty */ ;
+
+        return red_depth;
+}
+
+/**
+ * c_rbtree_rebuild() - Rebuild tree with minimal height
+ * @t:          Tree to operate on
+ *
+ * This relinks all nodes of ``t`` in place into a tree of minimal height.
+ * That is, the sizes of both sub-trees of every node differ by at most one.
+ * The tree is colored so it is a valid RB-Tree afterwards, and can be used
+ * with all other operations as before. No memory is allocated, and the
+ * comparison function is not needed, as the order of the nodes is retained.
+ *
+ * A rebuild is useful when switching from a phase of heavy modification to a
+ * read-mostly phase, as it can save a few layers on every lookup.
+ *
+ * This must not be called while lockless readers are traversing the tree.
+ *
+ * Worst case runtime (n: number of elements in tree): O(n)
+ */
+_c_public_ void c_rbtree_rebuild(CRBTree *t) {
+        CRBNode *list, *n;
+        size_t n_nodes;
+
+        c_assert(t);
+
+        list = c_rbtree_flatten(t, &n_nodes);
+        n = c_rbtree_build_list(&list, n_nodes, 0, c_rbtree_red_depth(n_nodes));
+        c_assert(!list);
+
+        t->root = NULL;
+        c_rbnode_push_root(n, t);
+}
+
+/**
+ * c_rbtree_build() - Build tree from sorted nodes
+ * @t:          Tree to build
+ * @nodes:      Array of nodes to link
+ * @n_nodes:    Number of nodes in ``nodes``
+ *
+ * This links all nodes of ``nodes`` into the empty tree ``t``, retaining their
+ * order in the array. That is, ``nodes`` must be sorted in ascending order,
+ * and must not contain duplicates. This is not verified! The nodes must not
+ * be linked. The result is a tree of minimal height, just like after
+ * :c:func:`c_rbtree_rebuild()`. The array is only read, and can be released
+ * once this returns.
+ *
+ * This is considerably faster than inserting the nodes one by one, since no
+ * comparisons and no rebalancing are needed. To build large trees from
+ * unsorted input on multiple threads, the input can be partitioned by
+ * key-range, each partition sorted and built into its own tree in parallel,
+ * and the trees then combined via :c:func:`c_rbtree_join()`.
+ *
+ * Worst case runtime (n: number of elements in tree): O(n)
+ */
+_c_public_ void c_rbtree_build(CRBTree *t, CRBNode **nodes, size_t n_nodes) {
+        CRBNode *n;
+
+        c_assert(t);
+        c_assert(!t->root);
+        c_assert(nodes || !n_nodes);
+
+        n = c_rbtree_build_array(nodes, n_nodes, 0, c_rbtree_red_depth(n_nodes));
+        c_rbnode_push_root(n, t);
+}
+
+/**
+ * c_rbtree_drain() - Detach batch of nodes from tree
+ * @t:          Tree to drain
+ * @nodes:      Output array for detached nodes
+ * @n_nodes:    Maximum number of nodes to detach
+ *
+ * This detaches up to ``n_nodes`` nodes from ``t`` in post-order, stores them
+ * in ``nodes``, and marks each of them as unlinked. The tree is not
+ * rebalanced. This is meant to tear down a tree in batches, so the nodes can
+ * be released in bulk (e.g., to batch calls into an allocator). Unlike the
+ * ``c_rbtree_for_each*_unlink()`` iterators, the tear-down can be interrupted
+ * after any batch. However, once a tree was partially drained, it must not be
+ * used with any other operation until it was drained completely.
+ *
+ * To tear down a tree on multiple threads, it can first be split into
+ * multiple trees via :c:func:`c_rbtree_partition()` and
+ * :c:func:`c_rbtree_split()`, which are then drained independently.
+ *
+ * Worst case runtime (n: number of elements in tree, k: batch size):
+ * O(log(n) + k)
+ *
+ * Return: Number of nodes stored in ``nodes``, 0 if the tree is empty.
+ */
+_c_public_ size_t c_rbtree_drain(CRBTree *t, CRBNode **nodes, size_t n_nodes) {
+        CRBNode *n, *p;
+        size_t i;
+
+        c_assert(t);
+        c_assert(nodes || !n_nodes);
+
+        n = t->root ? c_rbnode_leftdeepest(t->root) : NULL;
+        for (i = 0; n && i < n_nodes; ++i) {
+                /*
+                 * @n is a leaf. Cut it off its parent, which leaves the
+                 * parent with at most a right child. Hence, the next node in
+                 * post-order is the left-deepest node of the parent.
+                 */
+                p = c_rbnode_parent(n);
+                if (!p)
+                        t->root = NULL;
+                else if (n == p->left)
+                        p->left = NULL;
+                else
+                        p->right = NULL;
+
+                c_rbnode_init(n);
+                nodes[i] = n;
+                n = p ? c_rbnode_leftdeepest(p) : NULL;
+        }
+
+        return i;
+}
+
+/*
+ * A sub-tree with black-height @bh (i.e., the number of black nodes on every
+ * path from its root to a leaf) has at least 2^bh - 1 nodes, if all nodes are
+ * black. With a black root, it has at most 4^bh - 1 nodes, if every other
+ * layer is red. A red root can be put on top of two such sub-trees. Those
+ * helpers calculate the bounds, saturating on overflow.
+ */
+static size_t c_rbtree_size_min(size_t bh) {
+        return (bh >= sizeof(size_t) * 8) ? SIZE_MAX : ((size_t)1 << bh) - 1;
+}
+
+static size_t c_rbtree_size_max_black(size_t bh) {
+        return (bh >= sizeof(size_t) * 4) ? SIZE_MAX : ((size_t)1 << (2 * bh)) - 1;
+}
+
+static size_t c_rbtree_size_max(size_t bh) {
+        size_t max = c_rbtree_size_max_black(bh);
+
+        return (max > (SIZE_MAX - 1) / 2) ? SIZE_MAX : 2 * max + 1;
+}
+
+/*
+ * Build a tree from the first @n_nodes entries of @list, and advance @list
+ * past them, just like c_rbtree_build_list(). However, rather than splitting
+ * the list in the middle, this picks the weighted median as root, restricted
+ * to those positions that still allow a valid coloring of both sides with
+ * black-height @bh and a root of the given color. The parent/flags field of
+ * every list entry must contain the prefix sum of the weights of all entries
+ * up to and including itself. @base is the prefix sum before the first entry.
+ */
+static CRBNode *c_rbtree_build_weighted(CRBNode **list,
+                                        size_t n_nodes,
+                                        size_t bh,
+                                        _Bool red,
+                                        unsigned long base) {
+        size_t i, n_left, n_right, min, max, bh_child;
+        unsigned long total, sum;
+        CRBNode *n, *l, *r;
+
+        if (!n_nodes)
+                return NULL;
+
+        /* a red node has black children, a black node has any children */
+        if (red) {
+                bh_child = bh;
+                min = c_rbtree_size_min(bh_child);
+                max = c_rbtree_size_max_black(bh_child);
+        } else {
+                c_assert(bh > 0);
+                bh_child = bh - 1;
+                min = c_rbtree_size_min(bh_child);
+                max = c_rbtree_size_max(bh_child);
+        }
+
+        /* find the entry where the prefix sum crosses half the total */
+        for (i = 1, n = *list; i < n_nodes; ++i)
+                n = n->right;
+        total = n->__parent_and_flags - base;
+
+        if (total) {
+                for (i = 0, n = *list; i + 1 < n_nodes; ++i, n = n->right) {
+                        sum = n->__parent_and_flags - base;
+                        if (sum >= total - sum)
+                                break;
+                }
+                n_left = i;
+        } else {
+                n_left = n_nodes / 2;
+        }
+
+        /* move it into the range that allows valid sub-trees on both sides */
+        if (n_left + 1 + max < n_nodes)
+                n_left = n_nodes - 1 - max;
+        if (n_left > max)
+                n_left = max;
+        if (n_left < min)
+                n_left = min;
+        if (n_nodes - 1 - n_left < min)
+                n_left = n_nodes - 1 - min;
+        n_right = n_nodes - 1 - n_left;
+        c_assert(n_left >= min && n_left <= max);
+        c_assert(n_right >= min && n_right <= max);
+
+        /*
+         * Prefer black children, as they allow for more skew further down.
+         * Only paint them red, if they are too big to be black.
+         */
+        l = c_rbtree_build_weighted(list,
+                                    n_left,
+                                    bh_child,
+                                    !red && n_left > c_rbtree_size_max_black(bh_child),
+                                    base);
+        n = *list;
+        *list = n->right;
+        base = n->__parent_and_flags;
+        r = c_rbtree_build_weighted(list,
+                                    n_right,
+                                    bh_child,
+                                    !red && n_right > c_rbtree_size_max_black(bh_child),
+                                    base);
+
+        c_rbnode_set_parent_and_flags(n, NULL, red ? C_RBNODE_RED : 0);
+        c_rbtree_store(&n->left, l);
+        c_rbtree_store(&n->right, r);
+        if (l)
+                c_rbnode_set_parent_and_flags(l, n, c_rbnode_flags(l));
+        if (r)
+                c_rbnode_set_parent_and_flags(r, n, c_rbnode_flags(r));
+
+        return n;
+}
+
+/**
+ * c_rbtree_rebuild_weighted() - Rebuild tree based on access weights
+ * @t:          Tree to operate on
+ * @f:          Weight callback
+ * @userdata:   Userdata to pass to ``f``
+ *
+ * This is similar to :c:func:`c_rbtree_rebuild()`, but rather than building
+ * a tree of minimal height, it moves nodes with high weight closer to the
+ * root. ``f`` is called exactly once for every node, and must return its
+ * weight (e.g., the number of lookups that hit the node, as counted by the
+ * caller). The callback must not access the tree. The sum of all weights
+ * must fit into an ``unsigned long``.
+ *
+ * The tree is built top-down, each time picking the weighted median as root.
+ * This choice is restricted, such that the result is always a valid RB-Tree.
+ * That is, it can be used with all other operations as before. Furthermore,
+ * the height of the tree never exceeds ``2 * ceil(log4(n + 1))``, which is at
+ * most two layers more than a tree of minimal height. This way, a skewed
+ * lookup distribution gets faster on average, while the worst case stays
+ * bounded.
+ *
+ * This must not be called while lockless readers are traversing the tree.
+ *
+ * Worst case runtime (n: number of elements in tree): O(n log(n))
+ */
+_c_public_ void c_rbtree_rebuild_weighted(CRBTree *t, CRBWeightFunc f, void *userdata) {
+        unsigned long sum = 0;
+        size_t n_nodes, bh;
+        CRBNode *list, *n;
+
+        c_assert(t);
+        c_assert(f);
+
+        list = c_rbtree_flatten(t, &n_nodes);
+
+        /* temporarily store the prefix sums of the weights in the nodes */
+        for (n = list; n; n = n->right) {
+                sum += f(t, n, userdata);
+                n->__parent_and_flags = sum;
+        }
+
+        /* pick the minimal black-height, as it allows for the most skew */
+        for (bh = 0; c_rbtree_size_max_black(bh) < n_nodes; ++bh)
+                /* empty */ ;
+
+        n = c_rbtree_build_weighted(&list, n_nodes, bh, 0, 0);
+        c_assert(!list);
+
+        t->root = NULL;
+        c_rbnode_push_root(n, t);
+}
+
+/**
+ * DOC: Memory Layout
+ *
+ * The placement of nodes in memory is fully controlled by the API user. After
+ * heavy churn, the nodes of a tree are often spread across the heap, and each
+ * step of a lookup is likely to miss the cache. The following helpers allow
+ * moving the nodes of an existing tree into a layout that better matches the
+ * access pattern of lookups.
+ */
+/**/
+
+static CRBNode *c_rbtree_relocate_one(CRBTree *t, CRBNode *n, CRBRelocateFunc f, void *userdata) {
+        CRBNode *m, *p, *l, *r;
+        unsigned long v;
+
+        /*
+         * Cache all links of @n before invoking the callback, so the callback
+         * is free to release the old location right away. Then link the new
+         * location into the tree and make all neighbors point to it. The tree
+         * shape is not changed, so no rebalancing is needed.
+         */
+
+        v = n->__parent_and_flags;
+        p = c_rbnode_parent(n);
+        l = n->left;
+        r = n->right;
+
+        m = f(t, n, userdata);
+        c_assert(m);
+        if (m == n)
+                return n;
+
+        m->__parent_and_flags = v;
+        c_rbtree_store(&m->left, l);
+        c_rbtree_store(&m->right, r);
+
+        if (!p)
+                c_rbtree_store(&t->root, m);
+        else if (p->left == n)
+                c_rbtree_store(&p->left, m);
+        else
+                c_rbtree_store(&p->right, m);
+
+        if (l)
+                c_rbnode_set_parent_and_flags(l, m, c_rbnode_flags(l));
+        if (r)
+                c_rbnode_set_parent_and_flags(r, m, c_rbnode_flags(r));
+
+        return m;
+}
+
+static void c_rbtree_relocate_preorder(CRBTree *t, CRBNode *n, CRBRelocateFunc f, void *userdata) {
+        /* recurses at most to the tree height, which is O(log(n)) */
+        while (n) {
+                n = c_rbtree_relocate_one(t, n, f, userdata);
+                c_rbtree_relocate_preorder(t, n->left, f, userdata);
+                n = n->right;
+        }
+}
+
+static CRBNode *c_rbtree_relocate_veb(CRBTree *t, CRBNode *n, size_t depth, CRBRelocateFunc f, void *userdata);
+
+static void c_rbtree_relocate_veb_bottom(CRBTree *t,
+                                         CRBNode *n,
+                                         size_t level,
+                                         size_t depth,
+                                         CRBRelocateFunc f,
+                                         void *userdata) {
+        /*
+         * Relocate all sub-trees rooted @level layers below @n, from left to
+         * right, each with a height of @depth.
+         */
+        if (!n)
+                return;
+
+        if (!level) {
+                c_rbtree_relocate_veb(t, n, depth, f, userdata);
+        } else {
+                c_rbtree_relocate_veb_bottom(t, n->left, level - 1, depth, f, userdata);
+                c_rbtree_relocate_veb_bottom(t, n->right, level - 1, depth, f, userdata);
+        }
+}
+
+static CRBNode *c_rbtree_relocate_veb(CRBTree *t, CRBNode *n, size_t depth, CRBRelocateFunc f, void *userdata) {
+        size_t top;
+
+        /*
+         * Relocate the top @depth layers of the sub-tree at @n in van Emde
+         * Boas order: Split the sub-tree at half its height, relocate the
+         * top half recursively, and then each bottom tree recursively.
+         */
+        if (!n || !depth)
+                return n;
+        if (depth == 1)
+                return c_rbtree_relocate_one(t, n, f, userdata);
+
+        top = depth / 2;
+        n = c_rbtree_relocate_veb(t, n, top, f, userdata);
+        c_rbtree_relocate_veb_bottom(t, n, top, depth - top, f, userdata);
+
+        return n;
+}
+
+/* return the number of layers of the sub-tree at @n, without recursion */
+static size_t c_rbnode_height(CRBNode *n) {
+        size_t depth = 1, height = 0;
+        CRBNode *i = n, *p;
+
+        if (!n)
+                return 0;
+
+        for (;;) {
+                height = C_MAX(height, depth);
+
+                if (i->left) {
+                        i = i->left;
+                        ++depth;
+                        continue;
+                }
+                if (i->right) {
+                        i = i->right;
+                        ++depth;
+                        continue;
+                }
+
+                /* climb up until there is a right sibling left to visit */
+                for (;;) {
+                        if (i == n)
+                                return height;
+
+                        p = c_rbnode_parent(i);
+                        --depth;
+                        if (i == p->left && p->right) {
+                                i = p->right;
+                                ++depth;
+                                break;
+                        }
+                        i = p;
+                }
+        }
+}
+
+/**
+ * c_rbtree_relocate() - Relocate all nodes of a tree
+ * @t:          Tree to operate on
+ * @order:      Order to relocate nodes in
+ * @f:          Relocation callback
+ * @userdata:   Userdata to pass to ``f``
+ *
+ * This invokes ``f`` once for every node in ``t``, in the order given by
+ * ``order``, and lets it move the entry to a new memory location. See
+ * :c:type:`CRBRelocateFunc` for details on the callback. All node links and
+ * the tree root are updated to refer to the new locations. The tree shape,
+ * and thus the order of the nodes and their colors, is not changed.
+ *
+ * If the callback allocates the new locations consecutively (e.g., from a
+ * single contiguous region), the resulting memory layout follows ``order``:
+ *
+ * :C_RBTREE_RELOCATE_PREORDER: A depth-first layout, where each node is
+ *                              followed by its left sub-tree. The first steps
+ *                              of each descent share cache-lines.
+ *
+ * :C_RBTREE_RELOCATE_VEB: A cache-oblivious van Emde Boas layout, where
+ *                         sub-trees of half the height are stored
+ *                         contiguously. Every descent touches the minimal
+ *                         number of blocks, regardless of the block size.
+ *
+ * All link updates are done in an order that is safe for lockless readers.
+ * However, readers might still access the old locations, so the callback must
+ * not release them unless readers are excluded otherwise.
+ *
+ * Relocation recurses along the height of the tree. Nodes added via
+ * :c:func:`c_rbtree_add_relaxed()` that are still pending increase the
+ * height, so callers should repaint them first.
+ *
+ * Worst case runtime (n: number of elements in tree): O(n log(log(n)))
+ */
+_c_public_ void c_rbtree_relocate(CRBTree *t, CRBRelocateOrder order, CRBRelocateFunc f, void *userdata) {
+        c_assert(t);
+        c_assert(f);
+
+        switch (order) {
+        case C_RBTREE_RELOCATE_PREORDER:
+                c_rbtree_relocate_preorder(t, t->root, f, userdata);
+                break;
+        case C_RBTREE_RELOCATE_VEB:
+                /*
+                 * Twice the black-height would bound the height of a
+                 * balanced tree, but not while relaxed insertions are
+                 * pending. Hence, measure the exact height instead.
+                 */
+                c_rbtree_relocate_veb(t, t->root, c_rbnode_height(t->root), f, userdata);
+                break;
+        default:
+                c_assert(0);
+                break;
+        }
+}
+
+/**
+ * c_rbtree_eytzinger() - Export tree in Eytzinger order
+ * @t:          Tree to export
+ * @nodes:      Output array for the snapshot
+ * @n_nodes:    Number of slots in ``nodes``
+ *
+ * This stores pointers to all nodes of ``t`` in ``nodes``, in Eytzinger order.
+ * That is, the array forms a complete binary search tree in breadth-first
+ * order: the children of the node at index ``i`` are stored at ``2i+1`` and
+ * ``2i+2``. The resulting snapshot can be searched via
+ * :c:func:`c_rbtree_eytzinger_find_node()` and
+ * :c:func:`c_rbtree_eytzinger_find_lower_bound()`.
+ *
+ * If ``nodes`` is too small to hold all nodes, nothing is written. Callers can
+ * use this to query the required size first.
+ *
+ * Since the array is filled in index-order, callers can maintain any
+ * additional arrays (e.g., copies of integer keys for vectorized comparisons)
+ * in the same layout, by filling them in the same index order afterwards.
+ *
+ * Worst case runtime (n: number of elements in tree): O(n)
+ *
+ * Return: Number of nodes in ``t``.
+ */
+_c_public_ size_t c_rbtree_eytzinger(CRBTree *t, CRBNode **nodes, size_t n_nodes) {
+        size_t i, count = 0;
+        CRBNode *n;
+
+        c_assert(t);
+
+        c_rbtree_for_each(n, t)
+                ++count;
+        if (!count || count > n_nodes)
+                return count;
+
+        /*
+         * Traverse the tree in-order, and in lockstep traverse the implicit
+         * tree of 1-based indices in-order. Start at the leftmost index, and
+         * then either descend into the right sub-tree, or ascend as long as
+         * we are a right child.
+         */
+        for (i = 1; 2 * i <= count; i *= 2)
+                /* empty */ ;
+
+        c_rbtree_for_each(n, t) {
+                nodes[i - 1] = n;
+
+                if (2 * i + 1 <= count) {
+                        for (i = 2 * i + 1; 2 * i <= count; i *= 2)
+                                /* empty */ ;
+                } else {
+                        while (i & 1)
+                                i >>= 1;
+                        i >>= 1;
+                }
+        }
+
+        c_assert(!i);
+        return count;
+}
+
+/**
+ * DOC: Joining and Splitting
+ *
+ * Trees can be joined and split along their order in logarithmic time, without
+ * touching most of the nodes. This allows distributing ordered sets across
+ * multiple trees (e.g., to shard them by key-range), and moving nodes between
+ * them in bulk.
+ */
+/**/
+
+/* count the black nodes on the left-most path of the sub-tree at @n */
+static size_t c_rbnode_black_height(CRBNode *n) {
+        size_t bh = 0;
+
+        for ( ; n; n = n->left)
+                bh += c_rbnode_is_black(n);
+
+        return bh;
+}
+
+/* detach the root of @t, paint it black, and return it with its black-height */
+static CRBNode *c_rbtree_pop(CRBTree *t, size_t *bhp) {
+        CRBNode *n = t->root;
+
+        if (n) {
+                c_rbnode_pop_root(n);
+                c_rbnode_set_parent_and_flags(n, NULL, 0);
+                t->root = NULL;
+        }
+
+        *bhp = c_rbnode_black_height(n);
+        return n;
+}
+
+/**
+ * c_rbtree_join() - Join two trees
+ * @t:          Tree to join into
+ * @pivot:      Node to join at
+ * @from:       Tree to join
+ *
+ * This joins all nodes of ``t``, the node ``pivot``, and all nodes of ``from``
+ * into ``t``. ``from`` is empty afterwards. All nodes of ``t`` must order
+ * before ``pivot``, and ``pivot`` must order before all nodes of ``from``.
+ * This is not verified! ``pivot`` must not be linked.
+ *
+ * The smaller tree is linked into the border of the higher tree at the
+ * matching black-height, with ``pivot`` on top, and then the tree is
+ * rebalanced just like on insertion.
+ *
+ * This must not be called while lockless readers are traversing the trees.
+ *
+ * Worst case runtime (n: number of elements in both trees): O(log(n))
+ */
+_c_public_ void c_rbtree_join(CRBTree *t, CRBNode *pivot, CRBTree *from) {
+        CRBNode *l, *r, *p, *y, *root;
+        size_t bl, br, h;
+
+        c_assert(t);
+        c_assert(pivot);
+        c_assert(from);
+        c_assert(t != from);
+
+        l = c_rbtree_pop(t, &bl);
+        r = c_rbtree_pop(from, &br);
+
+        if (bl >= br) {
+                /*
+                 * Descend the right border of @l to the first black node with
+                 * the same black-height as @r, and replace it with @pivot,
+                 * carrying the old node on its left and @r on its right. Both
+                 * children of @pivot are black, so painting it red retains the
+                 * black-height.
+                 */
+                p = NULL;
+                y = l;
+                h = bl;
+                while (y && (c_rbnode_is_red(y) || h > br)) {
+                        h -= c_rbnode_is_black(y);
+                        p = y;
+                        y = y->right;
+                }
+
+                c_rbtree_store(&pivot->left, y);
+                c_rbtree_store(&pivot->right, r);
+                if (p)
+                        c_rbtree_store(&p->right, pivot);
+                root = p ? l : pivot;
+        } else /* if (bl < br) */ { /* same as above, but mirrored */
+                p = NULL;
+                y = r;
+                h = br;
+                while (y && (c_rbnode_is_red(y) || h > bl)) {
+                        h -= c_rbnode_is_black(y);
+                        p = y;
+                        y = y->left;
+                }
+
+                c_rbtree_store(&pivot->left, l);
+                c_rbtree_store(&pivot->right, y);
+                if (p)
+                        c_rbtree_store(&p->left, pivot);
+                root = p ? r : pivot;
+        }
+
+        c_rbnode_set_parent_and_flags(pivot, p, C_RBNODE_RED);
+        if (pivot->left)
+                c_rbnode_set_parent_and_flags(pivot->left, pivot, c_rbnode_flags(pivot->left));
+        if (pivot->right)
+                c_rbnode_set_parent_and_flags(pivot->right, pivot, c_rbnode_flags(pivot->right));
+
+        c_rbnode_push_root(root, t);
+
+        /* @pivot might have a red parent, or be the red root */
+        c_rbtree_paint(pivot);
+}
+
+/**
+ * c_rbtree_concat() - Concatenate two trees
+ * @t:          Tree to concatenate into
+ * @from:       Tree to concatenate
+ *
+ * This moves all nodes of ``from`` into ``t``. ``from`` is empty afterwards.
+ * All nodes of ``t`` must order before all nodes of ``from``. This is not
+ * verified!
+ *
+ * This is :c:func:`c_rbtree_join()` with the first node of ``from`` as pivot.
+ *
+ * This must not be called while lockless readers are traversing the trees.
+ *
+ * Worst case runtime (n: number of elements in both trees): O(log(n))
+ */
+_c_public_ void c_rbtree_concat(CRBTree *t, CRBTree *from) {
+        CRBNode *pivot;
+
+        c_assert(t);
+        c_assert(from);
+
+        pivot = c_rbtree_first(from);
+        if (pivot) {
+                c_rbnode_unlink_stale(pivot);
+                c_rbtree_join(t, pivot, from);
+        }
+}
+
+/*
+ * Detach the sub-tree at @n from its parent and make it the tree @t. Its root
+ * is painted black, which is always valid for a root. The parent is left with
+ * a dangling pointer, which the caller must overwrite.
+ */
+static void c_rbtree_adopt(CRBTree *t, CRBNode *n) {
+        t->root = NULL;
+        if (n) {
+                c_rbnode_set_parent_and_flags(n, NULL, 0);
+                c_rbnode_push_root(n, t);
+        }
+}
+
+/**
+ * c_rbtree_split() - Split a tree
+ * @t:          Tree to split
+ * @n:          Node to split at
+ * @to:         Destination tree
+ *
+ * This moves ``n`` and all nodes that follow it from ``t`` into ``to``. ``n``
+ * must be linked into ``t``, and ``to`` must be empty!
+ *
+ * The tree is split along the path from ``n`` to the root. All sub-trees
+ * hanging off this path to the left are joined into ``t``, all sub-trees
+ * hanging off to the right are joined into ``to``, each via
+ * :c:func:`c_rbtree_join()` with their parent on the path as pivot.
+ *
+ * This must not be called while lockless readers are traversing the trees.
+ *
+ * Worst case runtime (n: number of elements in tree): O(log(n)^2)
+ */
+_c_public_ void c_rbtree_split(CRBTree *t, CRBNode *n, CRBTree *to) {
+        CRBTree l = C_RBTREE_INIT, r = C_RBTREE_INIT, s = C_RBTREE_INIT;
+        CRBNode *a, *c, *p;
+
+        c_assert(t);
+        c_assert(to);
+        c_assert(!to->root);
+        c_assert(c_rbnode_is_linked(n));
+
+        /* split @n off, keeping it as first node of the right tree */
+        a = c_rbnode_parent(n);
+        c_rbtree_adopt(&l, n->left);
+        c_rbtree_adopt(&r, n->right);
+        c_rbtree_join(&s, n, &r);
+        c_rbtree_move(&r, &s);
+
+        /*
+         * Walk up the path and join each ancestor, together with its other
+         * sub-tree, to the side it orders on. The parent pointer of each
+         * ancestor is read before it is relinked.
+         */
+        for (c = n; a; c = a, a = p) {
+                p = c_rbnode_parent(a);
+                if (c == a->left) {
+                        c_rbtree_adopt(&s, a->right);
+                        c_rbtree_join(&r, a, &s);
+                } else {
+                        c_rbtree_adopt(&s, a->left);
+                        c_rbtree_join(&s, a, &l);
+                        c_rbtree_move(&l, &s);
+                }
+        }
+
+        t->root = NULL;
+        c_rbtree_move(t, &l);
+        c_rbtree_move(to, &r);
+}
+
+/**
+ * DOC: Merging
+ *
+ * Merge iterators keep a binary min-heap of cursors, one for each tree that
+ * still has nodes left. The heap is stored in the caller provided array, with
+ * the children of slot ``i`` at ``2i+1`` and ``2i+2``. The top of the heap is
+ * the next node to yield.
+ */
+/**/
+
+static void c_rbtree_merge_sift_up(CRBMerge *m, size_t i) {
+        CRBNode **heap = m->__heap, *n = heap[i];
+        size_t p;
+
+        while (i > 0) {
+                p = (i - 1) / 2;
+                if (m->__f(heap[p], n, m->__userdata) <= 0)
+                        break;
+
+                heap[i] = heap[p];
+                i = p;
+        }
+
+        heap[i] = n;
+}
+
+static void c_rbtree_merge_sift_down(CRBMerge *m, size_t i) {
+        CRBNode **heap = m->__heap, *n = heap[i];
+        size_t c;
+
+        while ((c = 2 * i + 1) < m->__n_heap) {
+                if (c + 1 < m->__n_heap && m->__f(heap[c + 1], heap[c], m->__userdata) < 0)
+                        ++c;
+                if (m->__f(n, heap[c], m->__userdata) <= 0)
+                        break;
+
+                heap[i] = heap[c];
+                i = c;
+        }
+
+        heap[i] = n;
+}
+
+/**
+ * c_rbtree_merge_init() - Initialize merge iterator
+ * @m:          Merge iterator to initialize
+ * @heap:       Heap storage
+ * @f:          Comparison function
+ * @userdata:   Userdata to pass to ``f``
+ *
+ * This initializes ``m`` as an empty merge iterator. Cursors must be added via
+ * :c:func:`c_rbtree_merge_add()` or :c:func:`c_rbtree_merge_seek()` before it
+ * yields any nodes. ``heap`` must provide storage for one node pointer for
+ * each cursor that is added. It is owned by the iterator until it is no longer
+ * used. ``f`` is used to order the cursors, see :c:type:`CRBMergeFunc` for
+ * details.
+ *
+ * The iterator does not own any resources, so it does not need to be
+ * deinitialized.
+ */
+_c_public_ void c_rbtree_merge_init(CRBMerge *m, CRBNode **heap, CRBMergeFunc f, void *userdata) {
+        c_assert(m);
+        c_assert(f);
+
+        *m = (CRBMerge)C_RBMERGE_INIT(heap, f, userdata);
+}
+
+/**
+ * c_rbtree_merge_add() - Add cursor to merge iterator
+ * @m:          Merge iterator to operate on
+ * @n:          Node to start at, or NULL
+ *
+ * This adds a cursor to the merge iterator ``m``, starting at ``n`` and
+ * following the order of the tree ``n`` is linked in. Usually, ``n`` is the
+ * first node of a tree (see :c:func:`c_rbtree_first()`). If ``n`` is NULL,
+ * this is a no-op, so empty trees can be added unconditionally.
+ *
+ * At most one cursor must be added for each tree, and the heap storage of
+ * ``m`` must be big enough to hold all of them.
+ *
+ * Worst case runtime (k: number of cursors): O(log(k))
+ */
+_c_public_ void c_rbtree_merge_add(CRBMerge *m, CRBNode *n) {
+        c_assert(m);
+
+        if (n) {
+                c_assert(c_rbnode_is_linked(n));
+
+                m->__heap[m->__n_heap] = n;
+                c_rbtree_merge_sift_up(m, m->__n_heap++);
+        }
+}
+
+/**
+ * c_rbtree_merge_seek() - Seek merge iterator to lower bound
+ * @m:          Merge iterator to operate on
+ * @trees:      Trees to merge
+ * @n_trees:    Number of trees to merge
+ * @f:          Comparison function
+ * @k:          Key to seek to
+ *
+ * This drops all cursors of ``m`` and adds a new cursor for each tree in
+ * ``trees``, starting at the lower bound of ``k`` in that tree (see
+ * :c:func:`c_rbtree_find_lower_bound()`). Hence, the next node yielded by the
+ * iterator is the first node of all trees that does not order before ``k``.
+ * The heap storage of ``m`` must hold at least ``n_trees`` node pointers.
+ *
+ * Passing a key that orders before all nodes restarts the iteration from the
+ * beginning.
+ *
+ * Worst case runtime (k: number of trees, n: number of elements per tree):
+ * O(k * log(n))
+ */
+_c_public_ void c_rbtree_merge_seek(CRBMerge *m, CRBTree **trees, size_t n_trees, CRBCompareFunc f, const void *k) {
+        size_t i;
+
+        c_assert(m);
+        c_assert(trees || !n_trees);
+
+        m->__n_heap = 0;
+        for (i = 0; i < n_trees; ++i)
+                c_rbtree_merge_add(m, c_rbtree_find_lower_bound(trees[i], f, k));
+}
+
+/**
+ * c_rbtree_merge_next() - Yield next node of a merge iterator
+ * @m:          Merge iterator to operate on
+ *
+ * This returns the next node of the merge iterator ``m`` in global order, and
+ * advances the cursor it was taken from. If nodes of different trees compare
+ * equal, it is unspecified which one is yielded first. Nodes of the same tree
+ * are always yielded in tree order.
+ *
+ * The cursor is advanced before the node is returned. Hence, the caller is
+ * free to unlink the returned node. Any other modification of the merged
+ * trees invalidates the iterator, and it must be re-seeked.
+ *
+ * Worst case runtime (k: number of cursors, n: number of elements per tree):
+ * O(log(k) + log(n))
+ *
+ * Return: Pointer to next node, or NULL if the iterator is exhausted.
+ */
+_c_public_ CRBNode *c_rbtree_merge_next(CRBMerge *m) {
+        CRBNode *n, *next;
+
+        c_assert(m);
+
+        if (!m->__n_heap)
+                return NULL;
+
+        n = m->__heap[0];
+        next = c_rbnode_next(n);
+        if (next)
+                m->__heap[0] = next;
+        else if (--m->__n_heap)
+                m->__heap[0] = m->__heap[m->__n_heap];
+        else
+                return n;
+
+        c_rbtree_merge_sift_down(m, 0);
+        return n;
+}
+
+/**
+ * DOC: Partitioning
+ *
+ * A tree can be partitioned into disjoint ranges of consecutive nodes, which
+ * can then be traversed independently (e.g., by multiple threads). Splitting
+ * points are taken from the top layers of the tree, so partitioning is cheap
+ * and does not modify the tree.
+ */
+/**/
+
+/**
+ * c_rbtree_partition() - Partition tree into ranges
+ * @t:          Tree to partition
+ * @ranges:     Output array for the first node of each range
+ * @n_ranges:   Maximum number of ranges
+ *
+ * This partitions the nodes of ``t`` into at most ``n_ranges`` ranges of
+ * consecutive nodes, and stores the first node of each range in ``ranges``,
+ * in tree order. Range ``i`` spans from ``ranges[i]`` up to, but excluding,
+ * ``ranges[i + 1]``. The last range spans to the end of the tree. Hence, each
+ * range can be traversed via :c:func:`c_rbnode_next()`, and the ranges can be
+ * traversed in parallel, as long as the tree is not modified.
+ *
+ * The nodes of the top layers of the tree are used as splitting points. That
+ * is, ``n_ranges`` is rounded down to a power of 2, and each range covers one
+ * sub-tree at that depth plus the splitting point preceding it. The shape of
+ * a red-black tree does not balance the size of sibling sub-trees, though.
+ * Siblings share their black-height ``bh``, but each can hold anywhere from
+ * ``2^bh - 1`` up to ``4^bh - 1`` nodes, so their sizes can differ by a factor
+ * of about ``2^bh``. Hence, how well the ranges are balanced depends entirely
+ * on the shape of the tree. Trees built from sorted input, for instance, tend
+ * to be heavier on the right. To balance load across threads, callers should
+ * request several times as many ranges as there are threads, and hand out the
+ * ranges on demand.
+ *
+ * Worst case runtime (k: number of ranges): O(k * log(k))
+ *
+ * Return: Number of ranges stored in ``ranges``.
+ */
+_c_public_ size_t c_rbtree_partition(CRBTree *t, CRBNode **ranges, size_t n_ranges) {
+        size_t i, j, mid, n = 0, depth = 0;
+        CRBNode *node;
+
+        c_assert(t);
+        c_assert(ranges || !n_ranges);
+
+        if (!t->root || !n_ranges)
+                return 0;
+
+        while (depth + 1 < sizeof(size_t) * 8 && ((size_t)2 << depth) <= n_ranges)
+                ++depth;
+
+        ranges[n++] = c_rbtree_first(t);
+
+        /*
+         * The splitting points are the nodes of the top @depth layers, in
+         * order. The in-order index @i of each such node, in a perfect tree
+         * of that depth, encodes its path from the root: Halving the index
+         * range at each layer selects the left or right child. Missing nodes
+         * are skipped. Only the left-most splitting point can coincide with
+         * the first node of the tree.
+         */
+        for (i = 1; i < ((size_t)1 << depth); ++i) {
+                node = t->root;
+                j = i;
+                mid = (size_t)1 << depth >> 1;
+                while (node && j != mid) {
+                        if (j < mid) {
+                                node = node->left;
+                        } else {
+                                node = node->right;
+                                j -= mid;
+                        }
+                        mid >>= 1;
+                }
+
+                if (node && node != ranges[n - 1])
+                        ranges[n++] = node;
+        }
+
+        return n;
+}
@@ -34,6 +34,8 @@ extern "C" {
 #include <assert.h>
 #include <stdalign.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
 typedef struct CRBNode CRBNode;
 typedef struct CRBTree CRBTree;
@@ -106,6 +108,7 @@ CRBNode *c_rbnode_prev_postorder(CRBNode *n);
 
 void c_rbnode_link(CRBNode *p, CRBNode **l, CRBNode *n);
 void c_rbnode_unlink_stale(CRBNode *n);
+void c_rbnode_replace(CRBNode *old, CRBNode *n);
 
 /**
  * struct CRBTree - Red-Black Tree Top-Level Structure
@@ -141,7 +144,55 @@ CRBNode *c_rbtree_first_postorder(CRBTree *t);
 CRBNode *c_rbtree_last_postorder(CRBTree *t);
 
 void c_rbtree_move(CRBTree *to, CRBTree *from);
+void c_rbtree_join(CRBTree *t, CRBNode *pivot, CRBTree *from);
+void c_rbtree_concat(CRBTree *t, CRBTree *from);
+void c_rbtree_split(CRBTree *t, CRBNode *n, CRBTree *to);
 void c_rbtree_add(CRBTree *t, CRBNode *p, CRBNode **l, CRBNode *n);
+_Bool c_rbtree_add_relaxed(CRBTree *t, CRBNode *p, CRBNode **l, CRBNode *n);
+void c_rbnode_repaint(CRBNode *n);
+void c_rbtree_rebuild(CRBTree *t);
+void c_rbtree_build(CRBTree *t, CRBNode **nodes, size_t n_nodes);
+size_t c_rbtree_drain(CRBTree *t, CRBNode **nodes, size_t n_nodes);
+
+/**
+ * CRBWeightFunc - Function type to get the weight of a node
+ *
+ * This callback is used by :c:func:`c_rbtree_rebuild_weighted()` to query the
+ * weight of the node ``n`` of tree ``t``. Higher weights move nodes closer to
+ * the root. ``userdata`` is passed through unchanged.
+ */
+typedef unsigned long (*CRBWeightFunc) (CRBTree *t, CRBNode *n, void *userdata);
+
+void c_rbtree_rebuild_weighted(CRBTree *t, CRBWeightFunc f, void *userdata);
+
+/**
+ * CRBRelocateFunc - Function type to relocate a node
+ *
+ * This callback is used by :c:func:`c_rbtree_relocate()` to move the entry
+ * embedding the node ``n`` of tree ``t`` to a new memory location. The
+ * callback must copy the entry to its new location, update any external
+ * references to it, and return a pointer to the embedded node in the new
+ * location. The node links of the new location are set by the caller, so the
+ * callback must not touch the tree. Once the callback returns, the old
+ * location is no longer accessed. ``userdata`` is passed through unchanged.
+ *
+ * The callback can return ``n`` to leave the entry in place.
+ */
+typedef CRBNode *(*CRBRelocateFunc) (CRBTree *t, CRBNode *n, void *userdata);
+
+/**
+ * enum CRBRelocateOrder - Order to relocate nodes in
+ * @C_RBTREE_RELOCATE_PREORDER:         Left-to-right pre-order (depth-first)
+ * @C_RBTREE_RELOCATE_VEB:              Van Emde Boas order (cache-oblivious)
+ */
+typedef enum CRBRelocateOrder {
+        C_RBTREE_RELOCATE_PREORDER,
+        C_RBTREE_RELOCATE_VEB,
+} CRBRelocateOrder;
+
+void c_rbtree_relocate(CRBTree *t, CRBRelocateOrder order, CRBRelocateFunc f, void *userdata);
+size_t c_rbtree_eytzinger(CRBTree *t, CRBNode **nodes, size_t n_nodes);
+size_t c_rbtree_partition(CRBTree *t, CRBNode **ranges, size_t n_ranges);
 
 /**
  * c_rbnode_init() - Mark a node as unlinked
@@ -296,6 +347,8 @@ static inline _Bool c_rbtree_is_empty(CRBTree *t) {
  */
 typedef int (*CRBCompareFunc) (CRBTree *t, void *k, CRBNode *n);
 
+CRBNode *c_rbnode_reposition(CRBTree *t, CRBNode *n, CRBCompareFunc f, const void *k);
+
 /**
  * c_rbtree_find_node() - Find node
  * @t:          Tree to search through
@@ -308,8 +361,9 @@ typedef int (*CRBCompareFunc) (CRBTree *t, void *k, CRBNode *n);
  * details.
  *
  * If there are multiple entries that compare equal to ``k``, this will return
- * a pseudo-randomly picked node. If you need stable lookup functions for trees
- * where duplicate entries are allowed, you better code your own lookup.
+ * a pseudo-randomly picked node. For stable lookups in trees where duplicate
+ * entries are allowed, use :c:func:`c_rbtree_find_equal_range()` (see
+ * "Duplicate Keys" below).
  *
  * Return: Pointer to matching node, or NULL.
  */
@@ -374,8 +428,15 @@ static inline CRBNode *c_rbtree_find_node(CRBTree *t, CRBCompareFunc f, const vo
  * cases, this will return a pointer (non-NULL) to the empty slot to insert the
  * node at. ``p`` will point to the parent node of that slot.
  *
- * If you want trees that allow duplicate nodes, you better code your own
- * insertion function.
+ * If you want trees that allow duplicate nodes, use
+ * :c:func:`c_rbtree_find_slot_multi()` instead, together with the other
+ * helpers described in "Duplicate Keys" below.
+ *
+ * Note that the parent is known before the new node has to exist. If you
+ * allocate your entries only after the slot was found, you can use ``p`` as a
+ * placement hint for your allocator. Entries placed close to their parent
+ * share cache-lines and pages during lookups, which can significantly reduce
+ * the cost of a tree descent.
  *
  * Return: Pointer to slot to insert node, or NULL on conflicts.
  */
@@ -402,6 +463,799 @@ static inline CRBNode **c_rbtree_find_slot(CRBTree *t, CRBCompareFunc f, const v
         return i;
 }
 
+/**
+ * c_rbtree_find_lower_bound() - Find lower bound
+ * @t:          Tree to search through
+ * @f:          Comparison function
+ * @k:          Key to search for
+ *
+ * This searches through ``t`` for the first node that does not order before
+ * ``k``. That is, it returns the first node that compares equal to ``k`` or,
+ * if there is none, the first node that orders after ``k``. See
+ * :c:func:`c_rbtree_find_node()` for details on ``f``.
+ *
+ * Return: Pointer to lower bound, or NULL.
+ */
+static inline CRBNode *c_rbtree_find_lower_bound(CRBTree *t, CRBCompareFunc f, const void *k) {
+        CRBNode *i, *n = NULL;
+
+        assert(t);
+        assert(f);
+
+        i = t->root;
+        while (i) {
+                if (f(t, (void *)k, i) > 0) {
+                        i = i->right;
+                } else {
+                        n = i;
+                        i = i->left;
+                }
+        }
+
+        return n;
+}
+
+/**
+ * c_rbtree_find_upper_bound() - Find upper bound
+ * @t:          Tree to search through
+ * @f:          Comparison function
+ * @k:          Key to search for
+ *
+ * This searches through ``t`` for the first node that orders after ``k``.
+ * See :c:func:`c_rbtree_find_node()` for details on ``f``.
+ *
+ * Return: Pointer to upper bound, or NULL.
+ */
+static inline CRBNode *c_rbtree_find_upper_bound(CRBTree *t, CRBCompareFunc f, const void *k) {
+        CRBNode *i, *n = NULL;
+
+        assert(t);
+        assert(f);
+
+        i = t->root;
+        while (i) {
+                if (f(t, (void *)k, i) >= 0) {
+                        i = i->right;
+                } else {
+                        n = i;
+                        i = i->left;
+                }
+        }
+
+        return n;
+}
+
+/**
+ * c_rbtree_insert_or_get() - Insert node unless its key is present
+ * @t:          Tree to operate on
+ * @f:          Comparison function
+ * @k:          Key of ``n``
+ * @n:          Node to insert
+ *
+ * This combines :c:func:`c_rbtree_find_slot()` and :c:func:`c_rbtree_add()`
+ * into a single descent. If a node that compares equal to ``k`` is already
+ * linked, it is returned and ``n`` is left untouched. Otherwise, ``n`` is
+ * linked at the slot found during the descent, and returned.
+ *
+ * Since this is inlined, the comparison function can be inlined as well, if
+ * it is known at compile time.
+ *
+ * Worst case runtime (n: number of elements in tree): O(log(n))
+ *
+ * Return: Pointer to the node linked with key ``k``.
+ */
+static inline CRBNode *c_rbtree_insert_or_get(CRBTree *t, CRBCompareFunc f, const void *k, CRBNode *n) {
+        CRBNode **i, *p;
+
+        assert(t);
+        assert(f);
+        assert(n);
+
+        i = &t->root;
+        p = NULL;
+        while (*i) {
+                int v = f(t, (void *)k, *i);
+                p = *i;
+                if (v < 0)
+                        i = &(*i)->left;
+                else if (v > 0)
+                        i = &(*i)->right;
+                else
+                        return p;
+        }
+
+        c_rbtree_add(t, p, i, n);
+        return n;
+}
+
+/**
+ * c_rbtree_remove_key() - Remove node by key
+ * @t:          Tree to operate on
+ * @f:          Comparison function
+ * @k:          Key to search for
+ *
+ * This searches ``t`` for a node that compares equal to ``k``, and unlinks it
+ * via :c:func:`c_rbnode_unlink()`, starting right at the node that was found.
+ *
+ * Worst case runtime (n: number of elements in tree): O(log(n))
+ *
+ * Return: Pointer to the removed node, or NULL if not found.
+ */
+static inline CRBNode *c_rbtree_remove_key(CRBTree *t, CRBCompareFunc f, const void *k) {
+        CRBNode *n;
+
+        n = c_rbtree_find_node(t, f, k);
+        if (n)
+                c_rbnode_unlink(n);
+
+        return n;
+}
+
+/**
+ * DOC: Duplicate Keys
+ *
+ * :c:func:`c_rbtree_find_slot()` and :c:func:`c_rbtree_insert_or_get()`
+ * reject keys that are already present. Trees can hold nodes that compare
+ * equal, though, as long as all of them are linked next to each other. The
+ * following helpers support such multimaps. Nodes are inserted after all
+ * nodes that compare equal, so nodes with equal keys retain their insertion
+ * order during in-order traversal. :c:func:`c_rbtree_find_lower_bound()` and
+ * :c:func:`c_rbtree_find_upper_bound()` work on multimaps as well.
+ */
+/**/
+
+/**
+ * c_rbtree_find_slot_multi() - Find slot to insert node after equal nodes
+ * @t:          Tree to search through
+ * @f:          Comparison function
+ * @k:          Key to search for
+ * @p:          Output storage for parent pointer
+ *
+ * This is the same as :c:func:`c_rbtree_find_slot()`, but it never fails.
+ * Instead, nodes that compare equal to ``k`` are treated as if they ordered
+ * before ``k``. Hence, the returned slot is right after the last node that
+ * compares equal to ``k``.
+ *
+ * Return: Pointer to slot to insert node.
+ */
+static inline CRBNode **c_rbtree_find_slot_multi(CRBTree *t, CRBCompareFunc f, const void *k, CRBNode **p) {
+        CRBNode **i;
+
+        assert(t);
+        assert(f);
+        assert(p);
+
+        i = &t->root;
+        *p = NULL;
+        while (*i) {
+                *p = *i;
+                if (f(t, (void *)k, *i) < 0)
+                        i = &(*i)->left;
+                else
+                        i = &(*i)->right;
+        }
+
+        return i;
+}
+
+/**
+ * c_rbtree_find_equal_range() - Find range of equal nodes
+ * @t:          Tree to search through
+ * @f:          Comparison function
+ * @k:          Key to search for
+ * @lastp:      Output storage for the last equal node
+ *
+ * This searches through ``t`` for all nodes that compare equal to ``k``. The
+ * first of them is returned, and the last of them is stored in ``lastp``. If
+ * there is none, NULL is returned and stored. All nodes in between can be
+ * reached via :c:func:`c_rbnode_next()`.
+ *
+ * Both ends are searched for in a single descent each.
+ *
+ * Return: Pointer to first equal node, or NULL.
+ */
+static inline CRBNode *c_rbtree_find_equal_range(CRBTree *t, CRBCompareFunc f, const void *k, CRBNode **lastp) {
+        CRBNode *i, *first = NULL, *last = NULL;
+        int v;
+
+        assert(t);
+        assert(f);
+        assert(lastp);
+
+        i = t->root;
+        while (i) {
+                v = f(t, (void *)k, i);
+                if (v > 0) {
+                        i = i->right;
+                } else {
+                        if (!v)
+                                first = i;
+                        i = i->left;
+                }
+        }
+
+        if (first) {
+                i = t->root;
+                while (i) {
+                        v = f(t, (void *)k, i);
+                        if (v < 0) {
+                                i = i->left;
+                        } else {
+                                if (!v)
+                                        last = i;
+                                i = i->right;
+                        }
+                }
+        }
+
+        *lastp = last;
+        return first;
+}
+
+/**
+ * c_rbtree_count_equal() - Count equal nodes
+ * @t:          Tree to search through
+ * @f:          Comparison function
+ * @k:          Key to search for
+ *
+ * This counts the nodes in ``t`` that compare equal to ``k``.
+ *
+ * Worst case runtime (n: number of elements in tree, m: number of equal
+ * nodes): O(log(n) + m)
+ *
+ * Return: Number of nodes that compare equal to ``k``.
+ */
+static inline size_t c_rbtree_count_equal(CRBTree *t, CRBCompareFunc f, const void *k) {
+        CRBNode *i, *last;
+        size_t n = 0;
+
+        for (i = c_rbtree_find_equal_range(t, f, k, &last); i; i = (i == last) ? NULL : c_rbnode_next(i))
+                ++n;
+
+        return n;
+}
+
+/**
+ * DOC: Key Hints
+ *
+ * If keys are stored out of line (e.g., strings or composite keys), every
+ * comparison during a descent dereferences the entry and then its key, even
+ * though most comparisons are decided by the first few bytes of the key. A
+ * :c:struct:`CRBHintNode` stores an order-preserving prefix of the key right
+ * next to the node links. The hinted lookups compare the hints first, and
+ * only invoke the comparison function if the hints are equal.
+ *
+ * A hint must be order-preserving: If the hint of key ``a`` is smaller than
+ * the hint of key ``b``, then ``a`` must order before ``b``. Equal hints
+ * imply nothing. :c:func:`c_rbtree_hint_from_bytes()` computes such hints for
+ * keys ordered like ``memcmp()``, with shorter keys ordered first on ties.
+ *
+ * All nodes of a tree searched via the hinted lookups must be embedded in a
+ * :c:struct:`CRBHintNode`, and their hint must be set before they are linked.
+ * All other tree operations work unchanged.
+ */
+/**/
+
+typedef struct CRBHintNode CRBHintNode;
+
+/**
+ * struct CRBHintNode - Node with key hint
+ * @node:       Embedded node
+ * @hint:       Order-preserving prefix of the key
+ *
+ * This is a :c:struct:`CRBNode` followed by a key hint. It is embedded into
+ * entries instead of a plain :c:struct:`CRBNode`, and ``node`` is linked into
+ * the tree as usual. ``hint`` is managed by the caller.
+ */
+struct CRBHintNode {
+        CRBNode node;
+        unsigned long long hint;
+};
+
+/**
+ * c_rbtree_hint_from_bytes() - Compute key hint from byte string
+ * @p:          Key to compute hint for
+ * @n:          Length of ``p`` in bytes
+ *
+ * This returns the first 8 bytes of ``p`` as big-endian integer, padded with
+ * zeroes. Hence, the hints preserve the order of ``memcmp()``, if shorter keys
+ * order before longer keys with the same prefix.
+ *
+ * Return: Key hint of ``p``.
+ */
+static inline unsigned long long c_rbtree_hint_from_bytes(const void *p, size_t n) {
+        const unsigned char *b = (const unsigned char *)p;
+        unsigned long long hint = 0;
+        size_t i;
+
+        for (i = 0; i < 8; ++i)
+                hint = (hint << 8) | (i < n ? b[i] : 0);
+
+        return hint;
+}
+
+/**
+ * c_rbtree_find_node_hinted() - Find node via key hints
+ * @t:          Tree to search through
+ * @f:          Comparison function
+ * @k:          Key to search for
+ * @hint:       Key hint of ``k``
+ *
+ * This is the same as :c:func:`c_rbtree_find_node()`, but it compares
+ * ``hint`` against the hints of the nodes first. ``f`` is only invoked if the
+ * hints are equal. All nodes of ``t`` must be embedded in a
+ * :c:struct:`CRBHintNode`.
+ *
+ * Return: Pointer to matching node, or NULL.
+ */
+static inline CRBNode *c_rbtree_find_node_hinted(CRBTree *t, CRBCompareFunc f, const void *k, unsigned long long hint) {
+        CRBHintNode *h;
+        CRBNode *i;
+        int v;
+
+        assert(t);
+        assert(f);
+
+        i = t->root;
+        while (i) {
+                h = c_rbnode_entry(i, CRBHintNode, node);
+                if (hint != h->hint)
+                        v = (hint < h->hint) ? -1 : 1;
+                else
+                        v = f(t, (void *)k, i);
+
+                if (v < 0)
+                        i = i->left;
+                else if (v > 0)
+                        i = i->right;
+                else
+                        return i;
+        }
+
+        return NULL;
+}
+
+/**
+ * c_rbtree_find_slot_hinted() - Find slot via key hints
+ * @t:          Tree to search through
+ * @f:          Comparison function
+ * @k:          Key to search for
+ * @hint:       Key hint of ``k``
+ * @p:          Output storage for parent pointer
+ *
+ * This is the same as :c:func:`c_rbtree_find_slot()`, but it compares
+ * ``hint`` against the hints of the nodes first. ``f`` is only invoked if the
+ * hints are equal. All nodes of ``t`` must be embedded in a
+ * :c:struct:`CRBHintNode`.
+ *
+ * Return: Pointer to slot to insert node, or NULL on conflicts.
+ */
+static inline CRBNode **c_rbtree_find_slot_hinted(CRBTree *t,
+                                                  CRBCompareFunc f,
+                                                  const void *k,
+                                                  unsigned long long hint,
+                                                  CRBNode **p) {
+        CRBHintNode *h;
+        CRBNode **i;
+        int v;
+
+        assert(t);
+        assert(f);
+        assert(p);
+
+        i = &t->root;
+        *p = NULL;
+        while (*i) {
+                h = c_rbnode_entry(*i, CRBHintNode, node);
+                if (hint != h->hint)
+                        v = (hint < h->hint) ? -1 : 1;
+                else
+                        v = f(t, (void *)k, *i);
+
+                *p = *i;
+                if (v < 0)
+                        i = &(*i)->left;
+                else if (v > 0)
+                        i = &(*i)->right;
+                else
+                        return NULL;
+        }
+
+        return i;
+}
+
+/**
+ * DOC: Byte-String Keys
+ *
+ * Trees keyed by byte-strings (e.g., hierarchical paths) often hold keys with
+ * long common prefixes. A generic comparison function rescans those prefixes
+ * on every level of a descent. The following helpers are specialized for
+ * nodes embedded in a :c:struct:`CRBBytesNode`, which carries a pointer to
+ * its key and the key length. Keys are ordered like ``memcmp()``, with
+ * shorter keys ordered first on ties.
+ *
+ * During a descent, all nodes of a sub-tree order between the closest
+ * ancestors on either side. Hence, they share at least as many leading bytes
+ * with the searched key as the shorter of the common prefixes with those two
+ * ancestors. The helpers track both prefix lengths and skip that many bytes
+ * on each comparison. The remaining bytes are compared word-wise.
+ */
+/**/
+
+typedef struct CRBBytesNode CRBBytesNode;
+
+/**
+ * struct CRBBytesNode - Node with byte-string key
+ * @node:       Embedded node
+ * @key:        Key of the node
+ * @n_key:      Length of ``key`` in bytes
+ *
+ * This is a :c:struct:`CRBNode` followed by a reference to its key. It is
+ * embedded into entries instead of a plain :c:struct:`CRBNode`, and ``node``
+ * is linked into the tree as usual. ``key`` and ``n_key`` are managed by the
+ * caller and must not change while the node is linked.
+ */
+struct CRBBytesNode {
+        CRBNode node;
+        const void *key;
+        size_t n_key;
+};
+
+/**
+ * c_rbtree_compare_bytes() - Compare byte-strings with known common prefix
+ * @a:          First key
+ * @n_a:        Length of ``a`` in bytes
+ * @b:          Second key
+ * @n_b:        Length of ``b`` in bytes
+ * @lcpp:       Length of the common prefix
+ *
+ * This compares ``a`` and ``b`` like ``memcmp()``, with the shorter key
+ * ordering first if one is a prefix of the other. The caller guarantees that
+ * the first ``*lcpp`` bytes of both keys are equal, and those are skipped.
+ * The actual length of the common prefix is stored in ``lcpp`` on return.
+ *
+ * Return: <0, 0, or >0 if ``a`` orders before, equal to, or after ``b``.
+ */
+static inline int c_rbtree_compare_bytes(const void *a, size_t n_a, const void *b, size_t n_b, size_t *lcpp) {
+        const unsigned char *ba = (const unsigned char *)a, *bb = (const unsigned char *)b;
+        size_t i = *lcpp, n = (n_a < n_b) ? n_a : n_b;
+
+        assert(i <= n);
+
+        /*
+         * Compare word-wise, and locate the first differing byte via the
+         * position of the lowest (little endian) or highest (big endian) set
+         * bit of their difference. If the byte order is unknown, all bytes
+         * are compared individually below.
+         */
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ || __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+        for ( ; i + sizeof(unsigned long long) <= n; i += sizeof(unsigned long long)) {
+                unsigned long long wa, wb;
+
+                memcpy(&wa, ba + i, sizeof(wa));
+                memcpy(&wb, bb + i, sizeof(wb));
+                if (wa != wb) {
+#  if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+                        i += __builtin_ctzll(wa ^ wb) / 8;
+#  else
+                        i += __builtin_clzll(wa ^ wb) / 8;
+#  endif
+                        *lcpp = i;
+                        return (ba[i] < bb[i]) ? -1 : 1;
+                }
+        }
+#endif
+
+        while (i < n && ba[i] == bb[i])
+                ++i;
+
+        *lcpp = i;
+        if (i < n)
+                return (ba[i] < bb[i]) ? -1 : 1;
+
+        return (n_a < n_b) ? -1 : (n_a > n_b) ? 1 : 0;
+}
+
+/**
+ * c_rbtree_find_node_bytes() - Find node by byte-string key
+ * @t:          Tree to search through
+ * @k:          Key to search for
+ * @n_k:        Length of ``k`` in bytes
+ *
+ * This is the equivalent of :c:func:`c_rbtree_find_node()` for trees of
+ * :c:struct:`CRBBytesNode` nodes.
+ *
+ * Return: Pointer to matching node, or NULL.
+ */
+static inline CRBNode *c_rbtree_find_node_bytes(CRBTree *t, const void *k, size_t n_k) {
+        size_t lo = 0, hi = 0, l;
+        CRBBytesNode *b;
+        CRBNode *i;
+        int v;
+
+        assert(t);
+
+        i = t->root;
+        while (i) {
+                b = c_rbnode_entry(i, CRBBytesNode, node);
+                l = (lo < hi) ? lo : hi;
+                v = c_rbtree_compare_bytes(k, n_k, b->key, b->n_key, &l);
+                if (v < 0) {
+                        hi = l;
+                        i = i->left;
+                } else if (v > 0) {
+                        lo = l;
+                        i = i->right;
+                } else {
+                        return i;
+                }
+        }
+
+        return NULL;
+}
+
+/**
+ * c_rbtree_find_slot_bytes() - Find slot by byte-string key
+ * @t:          Tree to search through
+ * @k:          Key to search for
+ * @n_k:        Length of ``k`` in bytes
+ * @p:          Output storage for parent pointer
+ *
+ * This is the equivalent of :c:func:`c_rbtree_find_slot()` for trees of
+ * :c:struct:`CRBBytesNode` nodes.
+ *
+ * Return: Pointer to slot to insert node, or NULL on conflicts.
+ */
+static inline CRBNode **c_rbtree_find_slot_bytes(CRBTree *t, const void *k, size_t n_k, CRBNode **p) {
+        size_t lo = 0, hi = 0, l;
+        CRBBytesNode *b;
+        CRBNode **i;
+        int v;
+
+        assert(t);
+        assert(p);
+
+        i = &t->root;
+        *p = NULL;
+        while (*i) {
+                b = c_rbnode_entry(*i, CRBBytesNode, node);
+                l = (lo < hi) ? lo : hi;
+                v = c_rbtree_compare_bytes(k, n_k, b->key, b->n_key, &l);
+                *p = *i;
+                if (v < 0) {
+                        hi = l;
+                        i = &(*i)->left;
+                } else if (v > 0) {
+                        lo = l;
+                        i = &(*i)->right;
+                } else {
+                        return NULL;
+                }
+        }
+
+        return i;
+}
+
+/**
+ * c_rbtree_find_lower_bound_bytes() - Find lower bound by byte-string key
+ * @t:          Tree to search through
+ * @k:          Key to search for
+ * @n_k:        Length of ``k`` in bytes
+ *
+ * This is the equivalent of :c:func:`c_rbtree_find_lower_bound()` for trees
+ * of :c:struct:`CRBBytesNode` nodes.
+ *
+ * Return: Pointer to lower bound, or NULL.
+ */
+static inline CRBNode *c_rbtree_find_lower_bound_bytes(CRBTree *t, const void *k, size_t n_k) {
+        size_t lo = 0, hi = 0, l;
+        CRBNode *i, *n = NULL;
+        CRBBytesNode *b;
+
+        assert(t);
+
+        i = t->root;
+        while (i) {
+                b = c_rbnode_entry(i, CRBBytesNode, node);
+                l = (lo < hi) ? lo : hi;
+                if (c_rbtree_compare_bytes(k, n_k, b->key, b->n_key, &l) > 0) {
+                        lo = l;
+                        i = i->right;
+                } else {
+                        hi = l;
+                        n = i;
+                        i = i->left;
+                }
+        }
+
+        return n;
+}
+
+/**
+ * DOC: Snapshots
+ *
+ * For read-mostly trees, :c:func:`c_rbtree_eytzinger()` can export the nodes
+ * of a tree into a plain array in Eytzinger order (i.e., breadth-first order
+ * of a complete binary tree). The following helpers search such an array
+ * with branch-free index arithmetic, and prefetch the array slots of the next
+ * layers ahead of time.
+ *
+ * The array only references the nodes of the tree, it does not copy them.
+ * Hence, it must be exported again whenever the tree is modified. Searching
+ * the array does not access the tree links, though.
+ */
+/**/
+
+/* implementation detail */
+static inline size_t c_rbtree_eytzinger_search(CRBTree *t,
+                                               CRBNode **nodes,
+                                               size_t n_nodes,
+                                               CRBCompareFunc f,
+                                               const void *k) {
+        size_t i = 1;
+
+        /*
+         * Use 1-based indices, so the children of @i are at 2i and 2i+1.
+         * Descend to the right whenever @k orders after the node, and to the
+         * left otherwise. Once we fall off the tree, the last node where we
+         * descended to the left is the lower bound of @k. Its index is
+         * recovered by dropping all trailing right-descents, plus the final
+         * left-descent.
+         */
+        while (i <= n_nodes) {
+                /* might point past the array, so avoid pointer arithmetic */
+                __builtin_prefetch((void *)((uintptr_t)nodes + (16 * i - 1) * sizeof(*nodes)));
+                i = 2 * i + (f(t, (void *)k, nodes[i - 1]) > 0);
+        }
+
+        return i >> (__builtin_ctzll(~(unsigned long long)i) + 1);
+}
+
+/**
+ * c_rbtree_eytzinger_find_lower_bound() - Find lower bound in a snapshot
+ * @t:          Tree the snapshot was exported from
+ * @nodes:      Snapshot as exported by :c:func:`c_rbtree_eytzinger()`
+ * @n_nodes:    Number of nodes in the snapshot
+ * @f:          Comparison function
+ * @k:          Key to search for
+ *
+ * This searches through the snapshot ``nodes`` for the first node that does
+ * not order before ``k``. That is, it returns the node that compares equal to
+ * ``k`` or, if there is none, the next node following ``k``. ``t`` is only
+ * passed as context to ``f``.
+ *
+ * Worst case runtime (n: number of elements in snapshot): O(log(n))
+ *
+ * Return: Pointer to lower bound, or NULL.
+ */
+static inline CRBNode *c_rbtree_eytzinger_find_lower_bound(CRBTree *t,
+                                                           CRBNode **nodes,
+                                                           size_t n_nodes,
+                                                           CRBCompareFunc f,
+                                                           const void *k) {
+        size_t i;
+
+        assert(f);
+        assert(nodes || !n_nodes);
+
+        i = c_rbtree_eytzinger_search(t, nodes, n_nodes, f, k);
+        return i ? nodes[i - 1] : NULL;
+}
+
+/**
+ * c_rbtree_eytzinger_find_node() - Find node in a snapshot
+ * @t:          Tree the snapshot was exported from
+ * @nodes:      Snapshot as exported by :c:func:`c_rbtree_eytzinger()`
+ * @n_nodes:    Number of nodes in the snapshot
+ * @f:          Comparison function
+ * @k:          Key to search for
+ *
+ * This is the equivalent of :c:func:`c_rbtree_find_node()` for snapshots. It
+ * searches through ``nodes`` for a node that compares equal to ``k``. If
+ * there are multiple, the first one is returned.
+ *
+ * Worst case runtime (n: number of elements in snapshot): O(log(n))
+ *
+ * Return: Pointer to matching node, or NULL.
+ */
+static inline CRBNode *c_rbtree_eytzinger_find_node(CRBTree *t,
+                                                    CRBNode **nodes,
+                                                    size_t n_nodes,
+                                                    CRBCompareFunc f,
+                                                    const void *k) {
+        CRBNode *n;
+
+        n = c_rbtree_eytzinger_find_lower_bound(t, nodes, n_nodes, f, k);
+        return (n && !f(t, (void *)k, n)) ? n : NULL;
+}
+
+/**
+ * DOC: Merging
+ *
+ * If an ordered set is distributed across multiple trees (e.g., per-thread or
+ * per-shard trees), a :c:type:`CRBMerge` iterator can be used to traverse all
+ * of them in global order. It keeps one cursor per tree in a binary min-heap,
+ * and advances the cursors via :c:func:`c_rbnode_next()`. Nodes are neither
+ * copied nor sorted, and the heap storage is provided by the caller.
+ *
+ * For ``k`` trees, the iterator needs storage for ``k`` node pointers. Each
+ * step costs O(log(k)) comparisons, plus the amortized O(1) cost of
+ * :c:func:`c_rbnode_next()`.
+ */
+/**/
+
+typedef struct CRBMerge CRBMerge;
+
+/**
+ * CRBMergeFunc - Function type to order two nodes
+ *
+ * This callback is used by :c:type:`CRBMerge` iterators to order the nodes
+ * ``a`` and ``b``, which usually belong to different trees. It must return
+ * less than, equal to, or greater than 0 if ``a`` orders before, equal to, or
+ * after ``b``, respectively. The order must be consistent with the order of
+ * each tree. ``userdata`` is passed through unchanged.
+ */
+typedef int (*CRBMergeFunc) (CRBNode *a, CRBNode *b, void *userdata);
+
+/**
+ * struct CRBMerge - Merge iterator across trees
+ * @__heap:             Caller provided heap storage
+ * @__n_heap:           Number of cursors on the heap
+ * @__f:                Comparison function
+ * @__userdata:         Userdata passed to the comparison function
+ *
+ * This is a merge iterator. It holds one cursor for each tree, each pointing
+ * to the next node of its tree to be yielded. See
+ * :c:func:`c_rbtree_merge_init()` for details.
+ *
+ * All fields are private to the implementation.
+ */
+struct CRBMerge {
+        CRBNode **__heap;
+        size_t __n_heap;
+        CRBMergeFunc __f;
+        void *__userdata;
+};
+
+#define C_RBMERGE_INIT(_heap, _f, _userdata) {                                 \
+                .__heap = (_heap),                                              \
+                .__f = (_f),                                                    \
+                .__userdata = (_userdata),                                      \
+        }
+
+void c_rbtree_merge_init(CRBMerge *m, CRBNode **heap, CRBMergeFunc f, void *userdata);
+void c_rbtree_merge_add(CRBMerge *m, CRBNode *n);
+void c_rbtree_merge_seek(CRBMerge *m, CRBTree **trees, size_t n_trees, CRBCompareFunc f, const void *k);
+CRBNode *c_rbtree_merge_next(CRBMerge *m);
+
+/**
+ * c_rbtree_merge_peek() - Peek at next node of a merge iterator
+ * @m:          Merge iterator to operate on
+ *
+ * This returns the node that the next call to :c:func:`c_rbtree_merge_next()`
+ * will yield, without advancing the iterator.
+ *
+ * Return: Pointer to next node, or NULL if the iterator is exhausted.
+ */
+static inline CRBNode *c_rbtree_merge_peek(CRBMerge *m) {
+        return m->__n_heap ? m->__heap[0] : NULL;
+}
+
+/**
+ * c_rbtree_for_each_merge() - Iterate nodes of a merge iterator
+ * @_iter:      Iterator variable
+ * @_merge:     Merge iterator to advance
+ *
+ * This advances the merge iterator ``_merge`` until it is exhausted, and
+ * stores each node it yields in ``_iter``. As the iterator always advances
+ * before a node is yielded, the loop body is allowed to unlink ``_iter`` from
+ * its tree.
+ */
+#define c_rbtree_for_each_merge(_iter, _merge)                                  \
+        for (_iter = c_rbtree_merge_next(_merge);                               \
+             _iter;                                                             \
+             _iter = c_rbtree_merge_next(_merge))
+
 /**
  * DOC: Iterators
  *
@@ -10,21 +10,50 @@
 #include <stdlib.h>
 #include <string.h>
 #include "c-rbtree.h"
+#include "c-rbtree-persist.h"
 
 typedef struct TestNode {
         CRBNode rb;
 } TestNode;
 
+static CRBNode *test_relocate(CRBTree *t, CRBNode *n, void *userdata) {
+        return n;
+}
+
+static int test_compare(CRBTree *t, void *k, CRBNode *n) {
+        return 0;
+}
+
+static int test_merge(CRBNode *a, CRBNode *b, void *userdata) {
+        return 0;
+}
+
+static int test_persist_compare(void *k, CRBPersistNode *n) {
+        return 0;
+}
+
+static CRBPersistNode *test_persist_copy(CRBPersistNode *n, void *userdata) {
+        return NULL;
+}
+
+static void test_persist_free(CRBPersistNode *n, void *userdata) {
+}
+
+static unsigned long test_weight(CRBTree *t, CRBNode *n, void *userdata) {
+        return 1;
+}
+
 static void test_api(void) {
-        CRBTree t = C_RBTREE_INIT, t2 = C_RBTREE_INIT;
-        CRBNode *i, *is, n = C_RBNODE_INIT(n), m = C_RBNODE_INIT(m);
+        CRBTree t = C_RBTREE_INIT, t2 = C_RBTREE_INIT, *trees[] = { &t, &t2 };
+        CRBNode *i, *is, *heap[2], n = C_RBNODE_INIT(n), m = C_RBNODE_INIT(m);
+        CRBMerge merge;
         TestNode *ie, *ies;
 
         assert(c_rbtree_is_empty(&t));
         assert(!c_rbnode_is_linked(&n));
         assert(!c_rbnode_entry(NULL, TestNode, rb));
 
-        /* init, is_linked, add, link, {unlink{,_stale}} */
+        /* init, is_linked, add{,_relaxed}, repaint, reposition, replace, link, {unlink{,_stale}} */
 
         c_rbtree_add(&t, NULL, &t.root, &n);
         assert(c_rbnode_is_linked(&n));
@@ -44,6 +73,17 @@ static void test_api(void) {
         c_rbnode_unlink_stale(&m);
         assert(c_rbnode_is_linked(&m)); /* @m wasn't touched */
 
+        c_rbnode_init(&n);
+        assert(!c_rbtree_add_relaxed(&t, NULL, &t.root, &n));
+        c_rbnode_repaint(&n);
+        assert(!c_rbnode_reposition(&t, &n, test_compare, NULL));
+        c_rbnode_init(&m);
+        c_rbnode_replace(&n, &m);
+        assert(t.root == &m);
+        c_rbnode_init(&n);
+        c_rbnode_replace(&m, &n);
+        assert(t.root == &n);
+
         c_rbnode_init(&n);
         assert(!c_rbnode_is_linked(&n));
 
@@ -57,6 +97,24 @@ static void test_api(void) {
 
         c_rbtree_move(&t2, &t);
 
+        /* join, concat, split */
+
+        c_rbtree_join(&t, &n, &t2);
+        assert(c_rbnode_is_linked(&n));
+        c_rbtree_split(&t, &n, &t2);
+        assert(c_rbtree_is_empty(&t));
+        c_rbtree_concat(&t, &t2);
+        assert(c_rbtree_is_empty(&t2));
+        c_rbnode_unlink(&n);
+        assert(c_rbtree_is_empty(&t));
+
+        /* rebuild */
+
+        c_rbtree_rebuild(&t);
+        c_rbtree_build(&t, NULL, 0);
+        assert(!c_rbtree_drain(&t, NULL, 0));
+        c_rbtree_rebuild_weighted(&t, test_weight, NULL);
+
         /* first, last, leftmost, rightmost, next, prev */
 
         assert(!c_rbtree_first(&t));
@@ -75,6 +133,29 @@ static void test_api(void) {
         assert(!c_rbnode_next_postorder(&n));
         assert(!c_rbnode_prev_postorder(&n));
 
+        /* relocate */
+
+        c_rbtree_relocate(&t, C_RBTREE_RELOCATE_PREORDER, test_relocate, NULL);
+        c_rbtree_relocate(&t, C_RBTREE_RELOCATE_VEB, test_relocate, NULL);
+
+        /* snapshots */
+
+        assert(!c_rbtree_eytzinger(&t, NULL, 0));
+
+        /* partitioning */
+
+        assert(!c_rbtree_partition(&t, NULL, 0));
+
+        /* merging */
+
+        c_rbtree_merge_init(&merge, heap, test_merge, NULL);
+        c_rbtree_merge_add(&merge, c_rbtree_first(&t));
+        assert(!c_rbtree_merge_peek(&merge));
+        assert(!c_rbtree_merge_next(&merge));
+        c_rbtree_merge_seek(&merge, trees, 2, test_compare, NULL);
+        c_rbtree_for_each_merge(i, &merge)
+                assert(!i);
+
         /* iterators */
 
         c_rbtree_for_each(i, &t)
@@ -101,7 +182,31 @@ static void test_api(void) {
                 assert(!ie);
 }
 
+static void test_api_persist(void) {
+        CRBPersistNode *i, *snapshot, n;
+        CRBPersistTree t;
+        CRBPersistIter it;
+
+        c_rbtree_persist_init(&t, test_persist_copy, test_persist_free, NULL);
+
+        assert(c_rbtree_persist_add(&t, test_persist_compare, NULL, &n));
+        assert(!c_rbtree_persist_add(&t, test_persist_compare, NULL, &n));
+        assert(c_rbtree_persist_find(t.root, test_persist_compare, NULL) == &n);
+        assert(c_rbtree_persist_remove(&t, test_persist_compare, NULL));
+        assert(!c_rbtree_persist_remove(&t, test_persist_compare, NULL));
+
+        snapshot = c_rbtree_persist_snapshot(&t);
+        c_rbtree_persist_iter_seek(&it, snapshot, test_persist_compare, NULL);
+        assert(!c_rbtree_persist_iter_next(&it));
+        c_rbtree_persist_for_each(i, &it, snapshot)
+                assert(!i);
+        c_rbtree_persist_release(&t, snapshot);
+
+        c_rbtree_persist_deinit(&t);
+}
+
 int main(int argc, char **argv) {
         test_api();
+        test_api_persist();
         return 0;
 }
@@ -222,6 +222,277 @@ static void test_shuffle(void) {
                 free(nodes[i]);
 }
 
+static size_t height(CRBNode *n) {
+        return n ? 1 + C_MAX(height(n->left), height(n->right)) : 0;
+}
+
+static void test_rebuild(void) {
+        CRBNode *nodes, *i;
+        CRBTree t = {};
+        size_t j, k, n, h;
+
+        nodes = malloc(1024 * sizeof(*nodes));
+        c_assert(nodes);
+        for (j = 0; j < 1024; ++j)
+                c_rbnode_init(&nodes[j]);
+
+        /* rebuild empty tree */
+        c_rbtree_rebuild(&t);
+        c_assert(c_rbtree_is_empty(&t));
+
+        for (j = 0; j < 1024; ++j) {
+                /* ascending insertion leaves the tree unbalanced */
+                insert(&t, &nodes[j]);
+
+                c_rbtree_rebuild(&t);
+                n = validate(&t);
+                c_assert(n == j + 1);
+
+                /* verify minimal height: ceil(log2(n + 1)) */
+                for (h = 0; (1UL << h) < n + 1; ++h)
+                        /* empty */ ;
+                c_assert(height(t.root) == h);
+        }
+
+        /* thin out the tree, rebuild it, and verify it is still usable */
+        for (j = 0; j < 1024; j += 3)
+                c_rbnode_unlink(&nodes[j]);
+        c_rbtree_rebuild(&t);
+        c_assert(validate(&t) == 1024 - 342);
+
+        for (j = 0; j < 1024; j += 3) {
+                insert(&t, &nodes[j]);
+                validate(&t);
+        }
+
+        for (k = 0, i = c_rbtree_first(&t); i; i = c_rbnode_next(i), ++k)
+                c_assert(i == &nodes[k]);
+        c_assert(k == 1024);
+
+        for (j = 0; j < 1024; ++j) {
+                c_rbnode_unlink(&nodes[j]);
+                validate(&t);
+        }
+        c_assert(c_rbtree_is_empty(&t));
+
+        free(nodes);
+}
+
+static void test_build(void) {
+        CRBNode *nodes, **array, *i;
+        CRBTree t = {};
+        size_t j, k, h;
+
+        nodes = malloc(512 * sizeof(*nodes));
+        array = malloc(512 * sizeof(*array));
+        c_assert(nodes && array);
+        for (j = 0; j < 512; ++j)
+                array[j] = &nodes[j];
+
+        for (j = 0; j <= 512; j += 1 + j / 8) {
+                for (k = 0; k < 512; ++k)
+                        c_rbnode_init(&nodes[k]);
+
+                c_rbtree_build(&t, array, j);
+                c_assert(validate(&t) == j);
+
+                /* verify minimal height: ceil(log2(n + 1)) */
+                for (h = 0; (1UL << h) < j + 1; ++h)
+                        /* empty */ ;
+                c_assert(height(t.root) == h);
+
+                for (k = 0, i = c_rbtree_first(&t); i; i = c_rbnode_next(i), ++k)
+                        c_assert(i == &nodes[k]);
+                c_assert(k == j);
+
+                /* verify the tree is still usable */
+                for (k = j; k < 512; ++k) {
+                        insert(&t, &nodes[k]);
+                        validate(&t);
+                }
+                for (k = 0; k < 512; ++k) {
+                        c_rbnode_unlink(&nodes[k]);
+                        validate(&t);
+                }
+                c_assert(c_rbtree_is_empty(&t));
+        }
+
+        free(array);
+        free(nodes);
+}
+
+static void test_drain(void) {
+        CRBNode *nodes, **order, *batch[37], *i;
+        CRBTree t = {};
+        size_t j, k, m, n;
+
+        nodes = malloc(512 * sizeof(*nodes));
+        order = malloc(512 * sizeof(*order));
+        c_assert(nodes && order);
+        for (j = 0; j < 512; ++j)
+                c_rbnode_init(&nodes[j]);
+
+        /* draining an empty tree yields nothing */
+        c_assert(!c_rbtree_drain(&t, batch, C_ARRAY_SIZE(batch)));
+
+        for (j = 0; j < 512; ++j)
+                insert(&t, &nodes[(j * 97) % 512]);
+
+        k = 0;
+        c_rbtree_for_each_postorder(i, &t)
+                order[k++] = i;
+        c_assert(k == 512);
+
+        /* drain in batches of varying size, and verify post-order */
+        for (j = 0, k = 0; ; ++j) {
+                n = c_rbtree_drain(&t, batch, j % C_ARRAY_SIZE(batch));
+                c_assert(n <= j % C_ARRAY_SIZE(batch));
+                if (!n && j % C_ARRAY_SIZE(batch))
+                        break;
+
+                for (m = 0; m < n; ++m) {
+                        c_assert(batch[m] == order[k++]);
+                        c_assert(!c_rbnode_is_linked(batch[m]));
+                }
+        }
+        c_assert(k == 512);
+        c_assert(c_rbtree_is_empty(&t));
+
+        free(order);
+        free(nodes);
+}
+
+static void test_relaxed(void) {
+        CRBNode *nodes, **pending, **i, *p, *n;
+        CRBTree t = {};
+        size_t j, k, m, n_pending;
+
+        nodes = malloc(2048 * sizeof(*nodes));
+        pending = malloc(2048 * sizeof(*pending));
+        c_assert(nodes && pending);
+
+        /*
+         * Ascending order stacks violations on top of each other, while the
+         * permuted order spreads them. Pending nodes are repainted in random
+         * order, interleaved with further insertions.
+         */
+        for (k = 0; k < 2; ++k) {
+                n_pending = 0;
+
+                for (j = 0; j < 2048; ++j) {
+                        n = &nodes[k ? (j * 97) % 2048 : j];
+
+                        i = &t.root;
+                        p = NULL;
+                        while (*i) {
+                                p = *i;
+                                i = (n < *i) ? &(*i)->left : &(*i)->right;
+                        }
+
+                        if (c_rbtree_add_relaxed(&t, p, i, n))
+                                pending[n_pending++] = n;
+
+                        while (n_pending && !(rand() % 4)) {
+                                m = rand() % n_pending;
+                                c_rbnode_repaint(pending[m]);
+                                pending[m] = pending[--n_pending];
+                        }
+                }
+
+                c_assert(n_pending);
+                while (n_pending)
+                        c_rbnode_repaint(pending[--n_pending]);
+
+                c_assert(validate(&t) == 2048);
+
+                /* repainting valid or unlinked nodes is a no-op */
+                c_rbnode_repaint(NULL);
+                c_rbnode_repaint(t.root);
+                c_assert(validate(&t) == 2048);
+
+                while (t.root)
+                        c_rbnode_unlink(t.root);
+                c_rbnode_repaint(&nodes[0]);
+        }
+
+        /* a single repaint resolves a chain of stacked violations */
+        for (j = 0, p = NULL; j < 2048; ++j) {
+                c_rbtree_add_relaxed(&t, p, p ? &p->right : &t.root, &nodes[j]);
+                p = &nodes[j];
+        }
+        c_rbnode_repaint(&nodes[2047]);
+        c_assert(validate(&t) == 2048);
+
+        free(pending);
+        free(nodes);
+}
+
+static void test_split(void) {
+        CRBTree t = {}, to = {};
+        CRBNode *nodes, *i;
+        size_t j, k;
+
+        nodes = malloc(512 * sizeof(*nodes));
+        c_assert(nodes);
+        for (j = 0; j < 512; ++j)
+                c_rbnode_init(&nodes[j]);
+
+        /* joining empty trees just links the pivot */
+        c_rbtree_join(&t, &nodes[0], &to);
+        c_assert(validate(&t) == 1);
+        c_assert(c_rbtree_is_empty(&to));
+        c_rbnode_unlink(&nodes[0]);
+
+        for (j = 0; j < 512; ++j)
+                insert(&t, &nodes[(j * 97) % 512]);
+
+        /* split at every node, verify both halves, and concatenate again */
+        for (k = 0; k < 512; ++k) {
+                c_rbtree_split(&t, &nodes[k], &to);
+                c_assert(validate(&t) == k);
+                c_assert(validate(&to) == 512 - k);
+                c_assert(!t.root || c_rbnode_raw(t.root) == (void *)&t);
+                c_assert(c_rbnode_raw(to.root) == (void *)&to);
+                c_assert(c_rbtree_first(&to) == &nodes[k]);
+                c_assert(!k || c_rbtree_last(&t) == &nodes[k - 1]);
+
+                if (k % 2) {
+                        c_rbtree_concat(&t, &to);
+                } else {
+                        /* use the split node as pivot */
+                        c_rbnode_unlink(&nodes[k]);
+                        c_rbtree_join(&t, &nodes[k], &to);
+                }
+
+                c_assert(validate(&t) == 512);
+                c_assert(c_rbtree_is_empty(&to));
+        }
+
+        for (j = 0, i = c_rbtree_first(&t); i; i = c_rbnode_next(i), ++j)
+                c_assert(i == &nodes[j]);
+        c_assert(j == 512);
+
+        /* split off few nodes at either end, and join trees of very different sizes */
+        for (k = 1; k < 512; k *= 3) {
+                c_rbtree_split(&t, &nodes[512 - k], &to);
+                c_assert(validate(&t) == 512 - k);
+                c_assert(validate(&to) == k);
+                c_rbtree_concat(&t, &to);
+                c_assert(validate(&t) == 512);
+
+                c_rbtree_split(&t, &nodes[k], &to);
+                c_assert(validate(&t) == k);
+                c_assert(validate(&to) == 512 - k);
+                c_rbtree_concat(&t, &to);
+                c_assert(validate(&t) == 512);
+        }
+
+        while (t.root)
+                c_rbnode_unlink(t.root);
+
+        free(nodes);
+}
+
 int main(int argc, char **argv) {
         unsigned int i;
 
@@ -235,5 +506,11 @@ int main(int argc, char **argv) {
         for (i = 0; i < 4; ++i)
                 test_shuffle();
 
+        test_rebuild();
+        test_build();
+        test_drain();
+        test_relaxed();
+        test_split();
+
         return 0;
 }
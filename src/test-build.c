@@ -0,0 +1,220 @@
+/*
+ * Benchmark Bulk Build
+ * This builds a tree from unsorted input, comparing one-by-one insertion via
+ * c_rbtree_add() against sorting the input and linking it via
+ * c_rbtree_build(). Furthermore, the latter is run on a growing number of
+ * threads: The input is partitioned by key-range via sampled splitters, each
+ * thread sorts its partition and builds its own tree, and the trees are then
+ * combined via c_rbtree_join(), with the first node of each partition as
+ * pivot.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <c-stdaux.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "c-rbtree.h"
+#include "c-rbtree-private.h"
+
+#define TEST_N_NODES (1UL << 18)
+#define TEST_MAX_THREADS 64
+#define TEST_OVERSAMPLING 64
+
+typedef struct {
+        unsigned long key;
+        CRBNode rb;
+} Node;
+
+typedef struct {
+        Node *nodes;
+        unsigned long lo;
+        unsigned long hi;
+        CRBNode *pivot;
+        CRBTree tree;
+} Partition;
+
+#define node_from_rb(_rb) ((Node *)((char *)(_rb) - offsetof(Node, rb)))
+
+static int compare(CRBTree *t, void *k, CRBNode *n) {
+        unsigned long key = (unsigned long)k;
+        Node *node = node_from_rb(n);
+
+        return (key < node->key) ? -1 : (key > node->key) ? 1 : 0;
+}
+
+static int compare_nodes(const void *a, const void *b) {
+        CRBNode * const *na = a, * const *nb = b;
+
+        return compare(NULL, (void *)node_from_rb(*na)->key, *nb);
+}
+
+static int compare_keys(const void *a, const void *b) {
+        const unsigned long *ka = a, *kb = b;
+
+        return (*ka < *kb) ? -1 : (*ka > *kb) ? 1 : 0;
+}
+
+static uint64_t now(void) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(CLOCK_MONOTONIC, &ts);
+        c_assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static void verify(CRBTree *t, Node *nodes) {
+        CRBNode *i, *o = NULL;
+        size_t n = 0;
+
+        for (i = c_rbtree_first(t); i; o = i, i = c_rbnode_next(i), ++n)
+                c_assert(!o || node_from_rb(o)->key < node_from_rb(i)->key);
+        c_assert(n == TEST_N_NODES);
+
+        for (n = 0; n < TEST_N_NODES; ++n)
+                c_rbnode_init(&nodes[n].rb);
+        c_rbtree_init(t);
+}
+
+static void build_add(CRBTree *t, Node *nodes) {
+        CRBNode **slot, *p;
+        size_t i;
+
+        for (i = 0; i < TEST_N_NODES; ++i) {
+                slot = c_rbtree_find_slot(t, compare, (void *)nodes[i].key, &p);
+                c_assert(slot);
+                c_rbtree_add(t, p, slot, &nodes[i].rb);
+        }
+}
+
+static void *build_thread(void *userdata) {
+        Partition *part = userdata;
+        CRBNode **array;
+        size_t i, n = 0;
+
+        /* collect the nodes of the key-range, sort them, and build the tree */
+        for (i = 0; i < TEST_N_NODES; ++i)
+                n += part->nodes[i].key >= part->lo && part->nodes[i].key < part->hi;
+
+        part->pivot = NULL;
+        c_rbtree_init(&part->tree);
+        if (!n)
+                return NULL;
+
+        array = malloc(n * sizeof(*array));
+        c_assert(array);
+
+        for (i = 0, n = 0; i < TEST_N_NODES; ++i)
+                if (part->nodes[i].key >= part->lo && part->nodes[i].key < part->hi)
+                        array[n++] = &part->nodes[i].rb;
+
+        qsort(array, n, sizeof(*array), compare_nodes);
+
+        /* keep the first node aside, to join the trees at */
+        part->pivot = array[0];
+        c_rbtree_build(&part->tree, array + 1, n - 1);
+
+        free(array);
+        return NULL;
+}
+
+static void build_parallel(CRBTree *t, Node *nodes, size_t n_threads) {
+        unsigned long samples[TEST_MAX_THREADS * TEST_OVERSAMPLING];
+        Partition parts[TEST_MAX_THREADS];
+        pthread_t threads[TEST_MAX_THREADS];
+        size_t i, n_samples;
+        int r;
+
+        /* pick the splitters from a sorted random sample of the input */
+        n_samples = n_threads * TEST_OVERSAMPLING;
+        for (i = 0; i < n_samples; ++i)
+                samples[i] = nodes[rand() % TEST_N_NODES].key;
+        qsort(samples, n_samples, sizeof(*samples), compare_keys);
+
+        for (i = 0; i < n_threads; ++i) {
+                parts[i].nodes = nodes;
+                parts[i].lo = i ? samples[i * TEST_OVERSAMPLING] : 0;
+                parts[i].hi = (i + 1 < n_threads) ? samples[(i + 1) * TEST_OVERSAMPLING] : ULONG_MAX;
+
+                r = pthread_create(&threads[i], NULL, build_thread, &parts[i]);
+                c_assert(!r);
+        }
+
+        for (i = 0; i < n_threads; ++i) {
+                r = pthread_join(threads[i], NULL);
+                c_assert(!r);
+        }
+
+        /* the partitions are ordered, so join them from left to right */
+        for (i = 0; i < n_threads; ++i) {
+                if (parts[i].pivot)
+                        c_rbtree_join(t, parts[i].pivot, &parts[i].tree);
+        }
+}
+
+static void test_build(void) {
+        size_t i, n_cpus;
+        CRBTree t = C_RBTREE_INIT;
+        CRBNode **array;
+        Node *nodes;
+        uint64_t ts, ts_link;
+        long v;
+
+        v = sysconf(_SC_NPROCESSORS_ONLN);
+        n_cpus = C_MIN(C_MAX(v, 1L), (long)TEST_MAX_THREADS);
+
+        nodes = malloc(TEST_N_NODES * sizeof(*nodes));
+        array = malloc(TEST_N_NODES * sizeof(*array));
+        c_assert(nodes && array);
+
+        /* multiplying by an odd constant permutes the keys */
+        for (i = 0; i < TEST_N_NODES; ++i) {
+                nodes[i].key = (i * 2654435761UL) & 0xffffffffUL;
+                c_rbnode_init(&nodes[i].rb);
+        }
+
+        fprintf(stderr, "method    threads       total        link\n");
+
+        ts = now();
+        build_add(&t, nodes);
+        ts = now() - ts;
+        verify(&t, nodes);
+        fprintf(stderr, "add       %7d %9"PRIu64"us %9"PRIu64"us\n", 1, ts / 1000, ts / 1000);
+
+        /* sorting dominates, so report the time to link separately */
+        ts = now();
+        for (i = 0; i < TEST_N_NODES; ++i)
+                array[i] = &nodes[i].rb;
+        qsort(array, TEST_N_NODES, sizeof(*array), compare_nodes);
+        ts_link = now();
+        c_rbtree_build(&t, array, TEST_N_NODES);
+        ts_link = now() - ts_link;
+        ts = now() - ts;
+        verify(&t, nodes);
+        fprintf(stderr, "build     %7d %9"PRIu64"us %9"PRIu64"us\n", 1, ts / 1000, ts_link / 1000);
+
+        for (i = 1; i <= 2 * n_cpus && i <= TEST_MAX_THREADS; i *= 2) {
+                ts = now();
+                build_parallel(&t, nodes, i);
+                ts = now() - ts;
+                verify(&t, nodes);
+                fprintf(stderr, "parallel  %7zu %9"PRIu64"us %11s\n", i, ts / 1000, "-");
+        }
+
+        free(array);
+        free(nodes);
+}
+
+int main(int argc, char **argv) {
+        /* we want stable tests, so use fixed seed */
+        srand(0xdeadbeef);
+
+        test_build();
+        return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * Benchmark Tree Disposal
+ * This tears down a tree of individually allocated entries, comparing the
+ * c_rbtree_for_each_entry_safe_postorder_unlink() iterator against batched
+ * tear-down via c_rbtree_drain(). Furthermore, the tree is split into one tree
+ * per thread via c_rbtree_partition() and c_rbtree_split(), and each thread
+ * drains and releases its own tree.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <c-stdaux.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "c-rbtree.h"
+#include "c-rbtree-private.h"
+
+#define TEST_N_NODES (1UL << 18)
+#define TEST_MAX_THREADS 64
+#define TEST_BATCH 64
+
+typedef struct {
+        unsigned long key;
+        CRBNode rb;
+} Node;
+
+typedef struct {
+        CRBTree tree;
+        size_t n_freed;
+} Part;
+
+#define node_from_rb(_rb) ((Node *)((char *)(_rb) - offsetof(Node, rb)))
+
+static int compare(CRBTree *t, void *k, CRBNode *n) {
+        unsigned long key = (unsigned long)k;
+        Node *node = node_from_rb(n);
+
+        return (key < node->key) ? -1 : (key > node->key) ? 1 : 0;
+}
+
+static uint64_t now(void) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(CLOCK_MONOTONIC, &ts);
+        c_assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static void populate(CRBTree *t) {
+        CRBNode **slot, *p;
+        Node *node;
+        size_t i;
+
+        for (i = 0; i < TEST_N_NODES; ++i) {
+                node = malloc(sizeof(*node));
+                c_assert(node);
+                c_rbnode_init(&node->rb);
+
+                do {
+                        node->key = rand();
+                        slot = c_rbtree_find_slot(t, compare, (void *)node->key, &p);
+                } while (!slot);
+                c_rbtree_add(t, p, slot, &node->rb);
+        }
+}
+
+static size_t dispose(CRBTree *t) {
+        CRBNode *batch[TEST_BATCH];
+        size_t i, n, n_freed = 0;
+
+        while ((n = c_rbtree_drain(t, batch, C_ARRAY_SIZE(batch)))) {
+                for (i = 0; i < n; ++i)
+                        free(node_from_rb(batch[i]));
+                n_freed += n;
+        }
+
+        return n_freed;
+}
+
+static void *dispose_thread(void *userdata) {
+        Part *part = userdata;
+
+        part->n_freed = dispose(&part->tree);
+        return NULL;
+}
+
+static void dispose_parallel(CRBTree *t, size_t n_threads) {
+        CRBNode *ranges[TEST_MAX_THREADS];
+        pthread_t threads[TEST_MAX_THREADS];
+        Part parts[TEST_MAX_THREADS];
+        size_t i, n, n_freed = 0;
+        int r;
+
+        /* split off the ranges from right to left */
+        n = c_rbtree_partition(t, ranges, n_threads);
+        for (i = n; i-- > 1; ) {
+                c_rbtree_init(&parts[i].tree);
+                c_rbtree_split(t, ranges[i], &parts[i].tree);
+        }
+        c_rbtree_init(&parts[0].tree);
+        c_rbtree_move(&parts[0].tree, t);
+
+        for (i = 0; i < n; ++i) {
+                r = pthread_create(&threads[i], NULL, dispose_thread, &parts[i]);
+                c_assert(!r);
+        }
+
+        for (i = 0; i < n; ++i) {
+                r = pthread_join(threads[i], NULL);
+                c_assert(!r);
+                n_freed += parts[i].n_freed;
+        }
+
+        c_assert(n_freed == TEST_N_NODES);
+        c_assert(c_rbtree_is_empty(t));
+}
+
+static void test_dispose(void) {
+        CRBTree t = C_RBTREE_INIT;
+        Node *node, *safe;
+        size_t i, n_cpus;
+        uint64_t ts;
+        long v;
+
+        v = sysconf(_SC_NPROCESSORS_ONLN);
+        n_cpus = C_MIN(C_MAX(v, 1L), (long)TEST_MAX_THREADS);
+
+        fprintf(stderr, "method    threads       time\n");
+
+        populate(&t);
+        ts = now();
+        c_rbtree_for_each_entry_safe_postorder_unlink(node, safe, &t, rb)
+                free(node);
+        ts = now() - ts;
+        c_assert(c_rbtree_is_empty(&t));
+        fprintf(stderr, "unlink    %7d %8"PRIu64"us\n", 1, ts / 1000);
+
+        populate(&t);
+        ts = now();
+        i = dispose(&t);
+        ts = now() - ts;
+        c_assert(i == TEST_N_NODES);
+        c_assert(c_rbtree_is_empty(&t));
+        fprintf(stderr, "drain     %7d %8"PRIu64"us\n", 1, ts / 1000);
+
+        for (i = 1; i <= 2 * n_cpus && i <= TEST_MAX_THREADS; i *= 2) {
+                populate(&t);
+                ts = now();
+                dispose_parallel(&t, i);
+                ts = now() - ts;
+                fprintf(stderr, "parallel  %7zu %8"PRIu64"us\n", i, ts / 1000);
+        }
+}
+
+int main(int argc, char **argv) {
+        /* we want stable tests, so use fixed seed */
+        srand(0xdeadbeef);
+
+        test_dispose();
+        return 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * Tests for Hashed Trees
+ * This runs random insertions and removals on a hashed tree and verifies both
+ * the hash index and the tree against a plain reference model after each
+ * step. The bucket array is grown on the way, and keys are picked such that
+ * many of them collide in the same buckets.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <c-stdaux.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "c-rbtree.h"
+#include "c-rbtree-hash.h"
+
+#define TEST_N_KEYS 1024
+
+typedef struct {
+        unsigned long key;
+        CRBHashNode hn;
+} Node;
+
+static int compare(CRBTree *t, void *k, CRBNode *n) {
+        unsigned long key = (unsigned long)k;
+        Node *node = c_rbnode_entry(n, Node, hn.rb);
+
+        return (key < node->key) ? -1 : (key > node->key) ? 1 : 0;
+}
+
+/* a weak hash, so several keys share their hash value */
+static size_t hash(unsigned long key) {
+        return (key / 3) * 2654435761UL;
+}
+
+static void verify(CRBHashTree *ht, Node *nodes, const bool *linked) {
+        unsigned long key;
+        CRBHashNode *h;
+        Node *n, *o = NULL;
+        size_t count = 0;
+
+        for (key = 0; key < TEST_N_KEYS; ++key) {
+                h = c_rbtree_hash_find(ht, compare, (void *)key, hash(key));
+                c_assert(linked[key] ? h == &nodes[key].hn : !h);
+                count += linked[key];
+        }
+        c_assert(c_rbtree_hash_size(ht) == count);
+
+        c_rbtree_for_each_entry(n, &ht->tree, hn.rb) {
+                c_assert(linked[n->key]);
+                c_assert(!o || o->key < n->key);
+                o = n;
+                --count;
+        }
+        c_assert(!count);
+}
+
+static void test_hash(void) {
+        CRBHashNode **buckets, **grown;
+        bool linked[TEST_N_KEYS] = {};
+        Node *nodes, other;
+        CRBHashNode *h;
+        CRBHashTree ht;
+        unsigned long key;
+        size_t i, n_buckets = 4;
+
+        nodes = malloc(TEST_N_KEYS * sizeof(*nodes));
+        buckets = malloc(n_buckets * sizeof(*buckets));
+        c_assert(nodes && buckets);
+
+        for (key = 0; key < TEST_N_KEYS; ++key) {
+                nodes[key].key = key;
+                c_rbtree_hash_node_init(&nodes[key].hn);
+        }
+
+        c_rbtree_hash_init(&ht, buckets, n_buckets);
+        verify(&ht, nodes, linked);
+
+        /* removing nodes that were never added is a no-op */
+        other = (Node){ .key = 0, .hn = C_RBHASHNODE_INIT(other.hn) };
+        c_rbtree_hash_remove(&ht, &other.hn);
+        c_rbtree_hash_remove(&ht, &nodes[0].hn);
+        c_assert(!c_rbtree_hash_size(&ht));
+        verify(&ht, nodes, linked);
+
+        for (i = 0; i < 8 * TEST_N_KEYS; ++i) {
+                key = rand() % TEST_N_KEYS;
+
+                if (rand() % 3) {
+                        h = c_rbtree_hash_add(&ht, compare, (void *)key, hash(key), &nodes[key].hn);
+                        c_assert(linked[key] ? h == &nodes[key].hn : !h);
+
+                        /* a second entry with the same key conflicts */
+                        other.key = key;
+                        h = c_rbtree_hash_add(&ht, compare, (void *)key, hash(key), &other.hn);
+                        c_assert(h == &nodes[key].hn);
+
+                        linked[key] = true;
+                } else {
+                        c_rbtree_hash_remove(&ht, &nodes[key].hn);
+                        c_assert(!c_rbnode_is_linked(&nodes[key].hn.rb));
+                        linked[key] = false;
+                }
+
+                /* grow the table once it is loaded */
+                if (c_rbtree_hash_size(&ht) > n_buckets) {
+                        grown = malloc(2 * n_buckets * sizeof(*grown));
+                        c_assert(grown);
+                        c_rbtree_hash_rehash(&ht, grown, 2 * n_buckets);
+                        free(buckets);
+                        buckets = grown;
+                        n_buckets *= 2;
+                }
+
+                if (!(i % 64))
+                        verify(&ht, nodes, linked);
+        }
+
+        verify(&ht, nodes, linked);
+
+        /* ordered range queries use the tree */
+        h = c_rbnode_entry(c_rbtree_find_lower_bound(&ht.tree, compare, (void *)(TEST_N_KEYS / 2)), CRBHashNode, rb);
+        for (key = TEST_N_KEYS / 2; key < TEST_N_KEYS && !linked[key]; ++key)
+                /* empty */ ;
+        c_assert(key < TEST_N_KEYS ? h == &nodes[key].hn : !h);
+
+        for (key = 0; key < TEST_N_KEYS; ++key)
+                c_rbtree_hash_remove(&ht, &nodes[key].hn);
+        c_assert(!c_rbtree_hash_size(&ht));
+        c_assert(c_rbtree_is_empty(&ht.tree));
+        for (i = 0; i < n_buckets; ++i)
+                c_assert(!buckets[i]);
+
+        free(buckets);
+        free(nodes);
+}
+
+int main(int argc, char **argv) {
+        /* we want stable tests, so use fixed seed */
+        srand(0xdeadbeef);
+
+        test_hash();
+        return 0;
+}
@@ -0,0 +1,368 @@
+/*
+ * Tests for Node Placement
+ * c-rbtree never allocates memory, so the placement of the nodes in memory is
+ * fully controlled by the API user. This test compares lookups on a tree whose
+ * entries were allocated individually via malloc(3) against a tree whose
+ * entries were placed by a simple slab-pool next to their parent node (as
+ * returned by c_rbtree_find_slot()).
+ *
+ * Furthermore, the malloc(3) based tree is exported as Eytzinger snapshot
+ * (searched both via the comparator, and via a mirrored key array), and
+ * compacted via c_rbtree_relocate(), both in depth-first and van Emde Boas
+ * order, and compared again.
+ *
+ * Besides timing, this counts the number of distinct pages touched by each
+ * descent, which is a deterministic estimate for the TLB pressure of a lookup.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <c-stdaux.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include "c-rbtree.h"
+#include "c-rbtree-private.h"
+
+#define TEST_N_NODES (1UL << 16)
+#define TEST_N_LOOKUPS (1UL << 18)
+#define TEST_SLAB_SIZE (4096UL)
+
+typedef struct {
+        unsigned long key;
+        CRBNode rb;
+} Node;
+
+#define node_from_rb(_rb) ((Node *)((char *)(_rb) - offsetof(Node, rb)))
+
+/*
+ * Slab Pool
+ *
+ * This is a minimal pool that hands out fixed-size entries from page-sized
+ * slabs of a single mapping. An allocation is placed into the slab of a given
+ * neighbor, if that slab has room left. Otherwise, it is placed into the
+ * most recently opened slab, or a fresh slab if that is full as well.
+ * Entries are never released individually; the entire pool is dropped at once.
+ */
+
+typedef struct {
+        char *map;
+        size_t n_map;
+        size_t n_slabs;
+        size_t i_slab;
+        unsigned short *slab_used;
+} Pool;
+
+static void pool_init(Pool *pool, size_t n_entries) {
+        size_t per_slab = TEST_SLAB_SIZE / sizeof(Node);
+
+        /* reserve twice the minimum, as slabs might be left half empty */
+        pool->n_slabs = 2 * ((n_entries + per_slab - 1) / per_slab) + 1;
+        pool->n_map = pool->n_slabs * TEST_SLAB_SIZE;
+        pool->map = mmap(NULL, pool->n_map, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        c_assert(pool->map != MAP_FAILED);
+#ifdef MADV_HUGEPAGE
+        /* best-effort; not all kernels support transparent huge-pages */
+        (void)madvise(pool->map, pool->n_map, MADV_HUGEPAGE);
+#endif
+
+        pool->i_slab = 0;
+        pool->slab_used = calloc(pool->n_slabs, sizeof(*pool->slab_used));
+        c_assert(pool->slab_used);
+}
+
+static void pool_deinit(Pool *pool) {
+        int r;
+
+        free(pool->slab_used);
+        r = munmap(pool->map, pool->n_map);
+        c_assert(!r);
+}
+
+static Node *pool_alloc_near(Pool *pool, void *neighbor) {
+        size_t per_slab = TEST_SLAB_SIZE / sizeof(Node), i;
+
+        if (neighbor) {
+                c_assert((char *)neighbor >= pool->map);
+                i = ((char *)neighbor - pool->map) / TEST_SLAB_SIZE;
+                c_assert(i < pool->n_slabs);
+        } else {
+                i = pool->i_slab;
+        }
+
+        if (pool->slab_used[i] >= per_slab) {
+                /* neighboring slab is full, use the current one instead */
+                i = pool->i_slab;
+                if (pool->slab_used[i] >= per_slab) {
+                        i = ++pool->i_slab;
+                        c_assert(i < pool->n_slabs);
+                }
+        }
+
+        return (Node *)(pool->map + i * TEST_SLAB_SIZE) + pool->slab_used[i]++;
+}
+
+static int compare(CRBTree *t, void *k, CRBNode *n) {
+        unsigned long key = (unsigned long)k;
+        Node *node = node_from_rb(n);
+
+        return (key < node->key) ? -1 : (key > node->key) ? 1 : 0;
+}
+
+static uint64_t now(void) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(CLOCK_MONOTONIC, &ts);
+        c_assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static void shuffle(unsigned long *keys, size_t n_memb) {
+        unsigned long t;
+        size_t i, j;
+
+        for (i = 0; i < n_memb; ++i) {
+                j = rand() % n_memb;
+                t = keys[j];
+                keys[j] = keys[i];
+                keys[i] = t;
+        }
+}
+
+static void lookup(CRBTree *t, unsigned long *keys, size_t n_keys, uint64_t *nsp, uint64_t *pagesp) {
+        uint64_t ts, n_pages = 0;
+        uintptr_t page, last;
+        CRBNode *i;
+        size_t j;
+
+        /* count distinct pages per descent (not timed) */
+        for (j = 0; j < n_keys; ++j) {
+                last = 0;
+                for (i = t->root; i; ) {
+                        int v = compare(t, (void *)keys[j], i);
+
+                        page = (uintptr_t)node_from_rb(i) / TEST_SLAB_SIZE;
+                        if (page != last)
+                                ++n_pages;
+                        last = page;
+
+                        if (v < 0)
+                                i = i->left;
+                        else if (v > 0)
+                                i = i->right;
+                        else
+                                break;
+                }
+        }
+
+        /* time the plain lookups */
+        ts = now();
+        for (j = 0; j < TEST_N_LOOKUPS; ++j) {
+                i = c_rbtree_find_node(t, compare, (void *)keys[j % n_keys]);
+                c_assert(i && node_from_rb(i)->key == keys[j % n_keys]);
+        }
+
+        *nsp = (now() - ts) / TEST_N_LOOKUPS;
+        *pagesp = n_pages * 100 / n_keys;
+}
+
+static void lookup_eytzinger(CRBTree *t,
+                             unsigned long *keys,
+                             size_t n_keys,
+                             bool mirror,
+                             uint64_t *nsp,
+                             uint64_t *pagesp) {
+        unsigned long *mirrored, key;
+        uint64_t ts, n_pages = 0;
+        uintptr_t page, last;
+        CRBNode **nodes, *i;
+        size_t j, k, n;
+
+        /*
+         * Export the tree as snapshot. If requested, mirror the keys into a
+         * separate array of the same layout, so the search does not have to
+         * dereference any entries, but just the final match.
+         */
+        nodes = malloc(n_keys * sizeof(*nodes));
+        mirrored = malloc(n_keys * sizeof(*mirrored));
+        c_assert(nodes && mirrored);
+        n = c_rbtree_eytzinger(t, nodes, n_keys);
+        c_assert(n == n_keys);
+        for (k = 0; k < n; ++k)
+                mirrored[k] = node_from_rb(nodes[k])->key;
+
+        /* count distinct pages of the arrays and the entries (not timed) */
+        for (j = 0; j < n_keys; ++j) {
+                last = 0;
+                for (k = 1; k <= n; k = 2 * k + (keys[j] > mirrored[k - 1])) {
+                        page = mirror ? (uintptr_t)&mirrored[k - 1] : (uintptr_t)&nodes[k - 1];
+                        page /= TEST_SLAB_SIZE;
+                        if (page != last)
+                                ++n_pages;
+                        last = page;
+
+                        if (!mirror) {
+                                ++n_pages;
+                                last = (uintptr_t)node_from_rb(nodes[k - 1]) / TEST_SLAB_SIZE;
+                        }
+                }
+        }
+
+        ts = now();
+        for (j = 0; j < TEST_N_LOOKUPS; ++j) {
+                key = keys[j % n_keys];
+                if (mirror) {
+                        for (k = 1; k <= n; k = 2 * k + (key > mirrored[k - 1]))
+                                /* empty */ ;
+                        k >>= __builtin_ffsl((long)~k);
+                        i = nodes[k - 1];
+                } else {
+                        i = c_rbtree_eytzinger_find_node(t, nodes, n, compare, (void *)key);
+                }
+                c_assert(i && node_from_rb(i)->key == key);
+        }
+
+        *nsp = (now() - ts) / TEST_N_LOOKUPS;
+        *pagesp = n_pages * 100 / n_keys;
+        free(mirrored);
+        free(nodes);
+}
+
+typedef struct {
+        Node *region;
+        size_t n_used;
+        bool release;
+} Relocation;
+
+static CRBNode *relocate(CRBTree *t, CRBNode *n, void *userdata) {
+        Relocation *relocation = userdata;
+        Node *node;
+
+        node = &relocation->region[relocation->n_used++];
+        node->key = node_from_rb(n)->key;
+        if (relocation->release)
+                free(node_from_rb(n));
+
+        return &node->rb;
+}
+
+static void print(const char *name, uint64_t ns, uint64_t pages) {
+        fprintf(stderr, "%8s: %6"PRIu64"ns %6"PRIu64".%02"PRIu64"\n",
+                name, ns, pages / 100, pages % 100);
+}
+
+static void test_locality(void) {
+        uint64_t ns_malloc, ns_pool, ns_snapshot, ns_mirror, ns_preorder, ns_veb;
+        uint64_t pages_malloc, pages_pool, pages_snapshot, pages_mirror, pages_preorder, pages_veb;
+        CRBTree t_malloc = C_RBTREE_INIT, t_pool = C_RBTREE_INIT;
+        Relocation relocation = {};
+        Node *node, *safe, *regions[2];
+        unsigned long *keys;
+        CRBNode **slot, *p;
+        void **filler;
+        Pool pool;
+        size_t i;
+
+        keys = malloc(TEST_N_NODES * sizeof(*keys));
+        filler = calloc(TEST_N_NODES, sizeof(*filler));
+        c_assert(keys && filler);
+
+        for (i = 0; i < TEST_N_NODES; ++i)
+                keys[i] = i;
+        shuffle(keys, TEST_N_NODES);
+
+        /*
+         * Build the malloc(3) based tree. Interleave the entries with
+         * randomly sized filler allocations, and release half of them again,
+         * to get a heap that resembles a long-running process.
+         */
+        for (i = 0; i < TEST_N_NODES; ++i) {
+                filler[i] = malloc(16 + rand() % 256);
+                c_assert(filler[i]);
+
+                node = malloc(sizeof(*node));
+                c_assert(node);
+                node->key = keys[i];
+
+                slot = c_rbtree_find_slot(&t_malloc, compare, (void *)node->key, &p);
+                c_assert(slot);
+                c_rbtree_add(&t_malloc, p, slot, &node->rb);
+
+                if (rand() % 2)
+                        filler[i] = c_free(filler[i]);
+        }
+
+        /* build the pool based tree, placing each entry near its parent */
+        pool_init(&pool, TEST_N_NODES);
+        for (i = 0; i < TEST_N_NODES; ++i) {
+                slot = c_rbtree_find_slot(&t_pool, compare, (void *)keys[i], &p);
+                c_assert(slot);
+
+                node = pool_alloc_near(&pool, p ? node_from_rb(p) : NULL);
+                node->key = keys[i];
+                c_rbtree_add(&t_pool, p, slot, &node->rb);
+        }
+
+        shuffle(keys, TEST_N_NODES);
+        lookup(&t_malloc, keys, TEST_N_NODES, &ns_malloc, &pages_malloc);
+        lookup(&t_pool, keys, TEST_N_NODES, &ns_pool, &pages_pool);
+        lookup_eytzinger(&t_malloc, keys, TEST_N_NODES, false, &ns_snapshot, &pages_snapshot);
+        lookup_eytzinger(&t_malloc, keys, TEST_N_NODES, true, &ns_mirror, &pages_mirror);
+
+        /*
+         * Compact the malloc(3) based tree into a contiguous region, first in
+         * depth-first order, then in van Emde Boas order.
+         */
+        regions[0] = malloc(TEST_N_NODES * sizeof(Node));
+        regions[1] = malloc(TEST_N_NODES * sizeof(Node));
+        c_assert(regions[0] && regions[1]);
+
+        relocation = (Relocation){ .region = regions[0], .release = true };
+        c_rbtree_relocate(&t_malloc, C_RBTREE_RELOCATE_PREORDER, relocate, &relocation);
+        c_assert(relocation.n_used == TEST_N_NODES);
+        lookup(&t_malloc, keys, TEST_N_NODES, &ns_preorder, &pages_preorder);
+
+        relocation = (Relocation){ .region = regions[1] };
+        c_rbtree_relocate(&t_malloc, C_RBTREE_RELOCATE_VEB, relocate, &relocation);
+        c_assert(relocation.n_used == TEST_N_NODES);
+        lookup(&t_malloc, keys, TEST_N_NODES, &ns_veb, &pages_veb);
+
+        fprintf(stderr, "            lookup   pages/lookup\n");
+        print("malloc", ns_malloc, pages_malloc);
+        print("pool", ns_pool, pages_pool);
+        print("snapshot", ns_snapshot, pages_snapshot);
+        print("mirror", ns_mirror, pages_mirror);
+        print("preorder", ns_preorder, pages_preorder);
+        print("veb", ns_veb, pages_veb);
+
+        /* better placement must never touch more pages */
+        c_assert(pages_pool <= pages_malloc);
+        c_assert(pages_preorder <= pages_malloc);
+        c_assert(pages_veb <= pages_preorder);
+
+        c_rbtree_for_each_entry_safe_postorder_unlink(node, safe, &t_malloc, rb)
+                c_assert(!c_rbnode_is_linked(&node->rb));
+        c_rbtree_for_each_entry_safe_postorder_unlink(node, safe, &t_pool, rb)
+                c_assert(!c_rbnode_is_linked(&node->rb));
+        free(regions[1]);
+        free(regions[0]);
+        pool_deinit(&pool);
+
+        for (i = 0; i < TEST_N_NODES; ++i)
+                free(filler[i]);
+        free(filler);
+        free(keys);
+}
+
+int main(int argc, char **argv) {
+        /* we want stable tests, so use fixed seed */
+        srand(0xdeadbeef);
+
+        test_locality();
+        return 0;
+}
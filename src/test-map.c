@@ -7,6 +7,7 @@
 #undef NDEBUG
 #include <assert.h>
 #include <c-stdaux.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,6 +30,10 @@ static int test_compare(CRBTree *t, void *k, CRBNode *n) {
         return (key < node->key) ? -1 : (key > node->key) ? 1 : 0;
 }
 
+static int test_merge_compare(CRBNode *a, CRBNode *b, void *userdata) {
+        return test_compare(NULL, (void *)node_from_rb(a)->key, b);
+}
+
 static void shuffle(Node **nodes, size_t n_memb) {
         unsigned int i, j;
         Node *t;
@@ -268,10 +273,444 @@ static void test_map(void) {
         c_assert(c_rbtree_is_empty(&t));
 }
 
+static void test_eytzinger(void) {
+        CRBNode **slot, *p, *snapshot[512];
+        CRBTree t = {};
+        Node nodes[300];
+        unsigned long i;
+        size_t n;
+
+        /* empty trees produce empty snapshots */
+        n = c_rbtree_eytzinger(&t, snapshot, 0);
+        c_assert(n == 0);
+        c_assert(!c_rbtree_eytzinger_find_node(&t, snapshot, n, test_compare, (void *)0));
+        c_assert(!c_rbtree_eytzinger_find_lower_bound(&t, snapshot, n, test_compare, (void *)0));
+        c_assert(!c_rbtree_find_lower_bound(&t, test_compare, (void *)0));
+
+        /* use even keys only, so we can search for keys in between */
+        for (i = 0; i < C_ARRAY_SIZE(nodes); ++i) {
+                nodes[i].key = 2 * ((i * 17) % C_ARRAY_SIZE(nodes));
+                slot = c_rbtree_find_slot(&t, test_compare, (void *)nodes[i].key, &p);
+                c_assert(slot);
+                c_rbtree_add(&t, p, slot, &nodes[i].rb);
+
+                /* export every intermediate tree and search it */
+                n = c_rbtree_eytzinger(&t, snapshot, i);
+                c_assert(n == i + 1);
+                n = c_rbtree_eytzinger(&t, snapshot, C_ARRAY_SIZE(snapshot));
+                c_assert(n == i + 1);
+
+                for (p = c_rbtree_first(&t); p; p = c_rbnode_next(p)) {
+                        c_assert(p == c_rbtree_eytzinger_find_node(&t, snapshot, n, test_compare,
+                                                                   (void *)node_from_rb(p)->key));
+                        c_assert(p == c_rbtree_eytzinger_find_lower_bound(&t, snapshot, n, test_compare,
+                                                                          (void *)node_from_rb(p)->key));
+                        c_assert(!c_rbtree_eytzinger_find_node(&t, snapshot, n, test_compare,
+                                                               (void *)(node_from_rb(p)->key + 1)));
+                        c_assert(c_rbnode_next(p) == c_rbtree_eytzinger_find_lower_bound(&t, snapshot, n, test_compare,
+                                                                                         (void *)(node_from_rb(p)->key + 1)));
+                        c_assert(p == c_rbtree_find_lower_bound(&t, test_compare, (void *)node_from_rb(p)->key));
+                        c_assert(c_rbnode_next(p) == c_rbtree_find_lower_bound(&t, test_compare,
+                                                                               (void *)(node_from_rb(p)->key + 1)));
+                }
+        }
+
+        /* verify the breadth-first layout */
+        for (i = 1; i < n; ++i) {
+                if (i & 1)
+                        c_assert(node_from_rb(snapshot[i])->key < node_from_rb(snapshot[(i - 1) / 2])->key);
+                else
+                        c_assert(node_from_rb(snapshot[i])->key > node_from_rb(snapshot[(i - 1) / 2])->key);
+        }
+
+        while (t.root)
+                c_rbnode_unlink(t.root);
+}
+
+static void test_merge(void) {
+        CRBTree trees[5] = {}, *tree_ptrs[C_ARRAY_SIZE(trees)];
+        CRBNode **slot, *p, *heap[C_ARRAY_SIZE(trees)];
+        Node nodes[1024];
+        CRBMerge m;
+        unsigned long i, j, k;
+
+        /* distribute even keys randomly across all but the last tree */
+        for (i = 0; i < C_ARRAY_SIZE(nodes); ++i) {
+                j = rand() % (C_ARRAY_SIZE(trees) - 1);
+                nodes[i].key = 2 * i;
+                slot = c_rbtree_find_slot(&trees[j], test_compare, (void *)nodes[i].key, &p);
+                c_assert(slot);
+                c_rbtree_add(&trees[j], p, slot, &nodes[i].rb);
+        }
+
+        for (i = 0; i < C_ARRAY_SIZE(trees); ++i)
+                tree_ptrs[i] = &trees[i];
+
+        /* merge from the start, yielding all nodes in global order */
+        c_rbtree_merge_init(&m, heap, test_merge_compare, NULL);
+        for (i = 0; i < C_ARRAY_SIZE(trees); ++i)
+                c_rbtree_merge_add(&m, c_rbtree_first(&trees[i]));
+
+        i = 0;
+        c_rbtree_for_each_merge(p, &m)
+                c_assert(p == &nodes[i++].rb);
+        c_assert(i == C_ARRAY_SIZE(nodes));
+        c_assert(!c_rbtree_merge_peek(&m));
+
+        /* seek to every key and in-between, and verify the remainder */
+        for (k = 0; k <= 2 * C_ARRAY_SIZE(nodes); k += 1 + rand() % 16) {
+                c_rbtree_merge_seek(&m, tree_ptrs, C_ARRAY_SIZE(trees), test_compare, (void *)k);
+
+                i = (k + 1) / 2;
+                if (i < C_ARRAY_SIZE(nodes))
+                        c_assert(c_rbtree_merge_peek(&m) == &nodes[i].rb);
+                c_rbtree_for_each_merge(p, &m)
+                        c_assert(p == &nodes[i++].rb);
+                c_assert(i == C_ARRAY_SIZE(nodes));
+        }
+
+        /* unlink all nodes while merging */
+        c_rbtree_merge_seek(&m, tree_ptrs, C_ARRAY_SIZE(trees), test_compare, (void *)0);
+        i = 0;
+        c_rbtree_for_each_merge(p, &m) {
+                c_assert(p == &nodes[i++].rb);
+                c_rbnode_unlink(p);
+        }
+        c_assert(i == C_ARRAY_SIZE(nodes));
+
+        for (i = 0; i < C_ARRAY_SIZE(trees); ++i)
+                c_assert(c_rbtree_is_empty(&trees[i]));
+}
+
+static void test_reposition(void) {
+        CRBTree t = {};
+        CRBNode *i, **slot, *p;
+        Node nodes[512];
+        unsigned long j, k, key;
+
+        /* use even keys, so nodes can move in between existing ones */
+        for (j = 0; j < C_ARRAY_SIZE(nodes); ++j) {
+                nodes[j].key = 2 * ((j * 97) % C_ARRAY_SIZE(nodes));
+                c_rbnode_init(&nodes[j].rb);
+                slot = c_rbtree_find_slot(&t, test_compare, (void *)nodes[j].key, &p);
+                c_assert(slot);
+                c_rbtree_add(&t, p, slot, &nodes[j].rb);
+        }
+
+        for (j = 0; j < 4096; ++j) {
+                k = rand() % C_ARRAY_SIZE(nodes);
+
+                /* alternate between small and arbitrary moves */
+                if (j % 2)
+                        key = rand() % (4 * C_ARRAY_SIZE(nodes));
+                else
+                        key = nodes[k].key + (rand() % 9) - 4;
+
+                i = c_rbtree_find_node(&t, test_compare, (void *)key);
+                p = c_rbnode_reposition(&t, &nodes[k].rb, test_compare, (void *)key);
+                if (i && i != &nodes[k].rb) {
+                        /* conflicting nodes unlink the moved node */
+                        c_assert(p == i);
+                        c_assert(!c_rbnode_is_linked(&nodes[k].rb));
+
+                        key = nodes[k].key;
+                        slot = c_rbtree_find_slot(&t, test_compare, (void *)key, &p);
+                        c_assert(slot);
+                        c_rbtree_add(&t, p, slot, &nodes[k].rb);
+                } else {
+                        c_assert(!p);
+                        nodes[k].key = key;
+                }
+
+                c_assert(c_rbtree_find_node(&t, test_compare, (void *)key) == &nodes[k].rb);
+        }
+
+        /* verify in-order traversal */
+        k = 0;
+        p = NULL;
+        c_rbtree_for_each(i, &t) {
+                c_assert(!p || node_from_rb(p)->key < node_from_rb(i)->key);
+                p = i;
+                ++k;
+        }
+        c_assert(k == C_ARRAY_SIZE(nodes));
+}
+
+static void test_replace(void) {
+        Node nodes[2][512], *n;
+        CRBNode **slot, *p;
+        CRBTree t = {};
+        size_t j, k;
+
+        for (j = 0; j < C_ARRAY_SIZE(nodes[0]); ++j) {
+                nodes[0][j].key = (j * 97) % C_ARRAY_SIZE(nodes[0]);
+                c_rbnode_init(&nodes[0][j].rb);
+                slot = c_rbtree_find_slot(&t, test_compare, (void *)nodes[0][j].key, &p);
+                c_assert(slot);
+                c_rbtree_add(&t, p, slot, &nodes[0][j].rb);
+        }
+
+        /* swap each entry for a copy, back and forth, in random order */
+        for (j = 0; j < 4 * C_ARRAY_SIZE(nodes[0]); ++j) {
+                k = rand() % C_ARRAY_SIZE(nodes[0]);
+                n = c_rbtree_find_entry(&t, test_compare, (void *)nodes[0][k].key, Node, rb);
+                c_assert(n == &nodes[0][k] || n == &nodes[1][k]);
+
+                n = (n == &nodes[0][k]) ? &nodes[1][k] : &nodes[0][k];
+                n->key = nodes[0][k].key;
+                c_rbnode_init(&n->rb);
+                c_rbnode_replace((n == &nodes[0][k]) ? &nodes[1][k].rb : &nodes[0][k].rb, &n->rb);
+                c_assert(c_rbtree_find_entry(&t, test_compare, (void *)n->key, Node, rb) == n);
+        }
+
+        /* the root is replaced like any other node */
+        k = node_from_rb(t.root)->key;
+        n = (t.root == &nodes[0][k].rb) ? &nodes[1][k] : &nodes[0][k];
+        n->key = k;
+        c_rbnode_init(&n->rb);
+        c_rbnode_replace(t.root, &n->rb);
+        c_assert(t.root == &n->rb);
+        c_assert(c_rbnode_is_black(t.root));
+
+        /* verify order, links, and colors */
+        k = 0;
+        c_rbtree_for_each_entry(n, &t, rb) {
+                c_assert(n->key == k++);
+                c_assert(!n->rb.left || c_rbnode_parent(n->rb.left) == &n->rb);
+                c_assert(!n->rb.right || c_rbnode_parent(n->rb.right) == &n->rb);
+                c_assert(!c_rbnode_is_red(&n->rb) || !n->rb.left || c_rbnode_is_black(n->rb.left));
+        }
+        c_assert(k == C_ARRAY_SIZE(nodes[0]));
+}
+
+static void test_insert_or_get(void) {
+        bool present[256] = {};
+        CRBNode *i;
+        CRBTree t = {};
+        Node nodes[1024];
+        size_t j, n = 0;
+        unsigned long key;
+
+        for (j = 0; j < C_ARRAY_SIZE(nodes); ++j) {
+                key = rand() % C_ARRAY_SIZE(present);
+                nodes[j].key = key;
+
+                if (rand() % 2) {
+                        i = c_rbtree_insert_or_get(&t, test_compare, (void *)key, &nodes[j].rb);
+                        c_assert(node_from_rb(i)->key == key);
+                        c_assert((i == &nodes[j].rb) == !present[key]);
+                        n += !present[key];
+                        present[key] = true;
+                } else {
+                        i = c_rbtree_remove_key(&t, test_compare, (void *)key);
+                        c_assert(!i == !present[key]);
+                        c_assert(!i || (node_from_rb(i)->key == key && !c_rbnode_is_linked(i)));
+                        n -= present[key];
+                        present[key] = false;
+                }
+
+                c_assert(!c_rbtree_find_node(&t, test_compare, (void *)key) == !present[key]);
+        }
+
+        j = 0;
+        c_rbtree_for_each(i, &t)
+                ++j;
+        c_assert(j == n);
+}
+
+static void test_multimap(void) {
+        size_t count[64] = {};
+        CRBNode **slot, *p, *i, *last;
+        CRBTree t = {};
+        Node nodes[1024];
+        unsigned long key;
+        size_t j, n;
+
+        /* the marker records the insertion order */
+        for (j = 0; j < C_ARRAY_SIZE(nodes); ++j) {
+                key = rand() % C_ARRAY_SIZE(count);
+                nodes[j].key = key;
+                nodes[j].marker = j;
+                slot = c_rbtree_find_slot_multi(&t, test_compare, (void *)key, &p);
+                c_assert(slot);
+                c_rbtree_add(&t, p, slot, &nodes[j].rb);
+                ++count[key];
+        }
+
+        /* remove some, to get holes in the ranges */
+        for (j = 0; j < C_ARRAY_SIZE(nodes); j += 7) {
+                c_rbnode_unlink(&nodes[j].rb);
+                --count[nodes[j].key];
+        }
+
+        for (key = 0; key <= C_ARRAY_SIZE(count); ++key) {
+                n = (key < C_ARRAY_SIZE(count)) ? count[key] : 0;
+                c_assert(c_rbtree_count_equal(&t, test_compare, (void *)key) == n);
+
+                i = c_rbtree_find_equal_range(&t, test_compare, (void *)key, &last);
+                c_assert(!i == !n && !last == !n);
+                if (!n) {
+                        p = c_rbtree_find_lower_bound(&t, test_compare, (void *)key);
+                        c_assert(p == c_rbtree_find_upper_bound(&t, test_compare, (void *)key));
+                        continue;
+                }
+
+                c_assert(i == c_rbtree_find_lower_bound(&t, test_compare, (void *)key));
+                c_assert(c_rbnode_next(last) == c_rbtree_find_upper_bound(&t, test_compare, (void *)key));
+
+                /* equal nodes retain their insertion order */
+                for (j = 1; i != last; i = c_rbnode_next(i), ++j) {
+                        c_assert(node_from_rb(i)->key == key);
+                        c_assert(node_from_rb(i)->marker < node_from_rb(c_rbnode_next(i))->marker);
+                }
+                c_assert(node_from_rb(last)->key == key);
+                c_assert(j == n);
+        }
+}
+
+typedef struct {
+        char key[32];
+        CRBHintNode rb;
+} HintNode;
+
+static size_t n_hint_compares;
+
+static int test_hint_compare(CRBTree *t, void *k, CRBNode *n) {
+        HintNode *node = c_rbnode_entry(n, HintNode, rb.node);
+
+        ++n_hint_compares;
+        return strcmp(k, node->key);
+}
+
+static void test_hinted(void) {
+        HintNode nodes[512];
+        CRBNode **slot, *p;
+        CRBTree t = {};
+        unsigned long long hint;
+        char key[32];
+        size_t j;
+
+        /* half of the keys share a prefix longer than the hint */
+        for (j = 0; j < C_ARRAY_SIZE(nodes); ++j) {
+                snprintf(nodes[j].key, sizeof(nodes[j].key), (j % 2) ? "/usr/lib/%zu" : "%zu", (j * 97) % C_ARRAY_SIZE(nodes));
+                nodes[j].rb.hint = c_rbtree_hint_from_bytes(nodes[j].key, strlen(nodes[j].key));
+
+                slot = c_rbtree_find_slot_hinted(&t, test_hint_compare, nodes[j].key, nodes[j].rb.hint, &p);
+                c_assert(slot);
+                c_rbtree_add(&t, p, slot, &nodes[j].rb.node);
+                c_assert(!c_rbtree_find_slot_hinted(&t, test_hint_compare, nodes[j].key, nodes[j].rb.hint, &p));
+                c_assert(p == &nodes[j].rb.node);
+        }
+
+        /* the hinted order must match the order of the comparison function */
+        for (p = c_rbtree_first(&t); c_rbnode_next(p); p = c_rbnode_next(p))
+                c_assert(test_hint_compare(NULL, c_rbnode_entry(p, HintNode, rb.node)->key, c_rbnode_next(p)) < 0);
+
+        n_hint_compares = 0;
+        for (j = 0; j < C_ARRAY_SIZE(nodes); ++j) {
+                hint = c_rbtree_hint_from_bytes(nodes[j].key, strlen(nodes[j].key));
+                p = c_rbtree_find_node_hinted(&t, test_hint_compare, nodes[j].key, hint);
+                c_assert(p == &nodes[j].rb.node);
+
+                snprintf(key, sizeof(key), (j % 2) ? "/usr/lib/%zu-" : "%zu-", (j * 97) % C_ARRAY_SIZE(nodes));
+                hint = c_rbtree_hint_from_bytes(key, strlen(key));
+                c_assert(!c_rbtree_find_node_hinted(&t, test_hint_compare, key, hint));
+
+                /* short keys have unique hints, so only the match compares */
+                if (!(j % 2))
+                        c_assert(n_hint_compares == 1);
+                n_hint_compares = 0;
+        }
+}
+
+typedef struct {
+        char key[48];
+        CRBBytesNode rb;
+} BytesNode;
+
+static int test_bytes_compare(const char *a, size_t n_a, const char *b, size_t n_b) {
+        int v = memcmp(a, b, C_MIN(n_a, n_b));
+
+        v = v ? v : (n_a < n_b) ? -1 : (n_a > n_b) ? 1 : 0;
+        return (v > 0) - (v < 0);
+}
+
+static void test_bytes(void) {
+        BytesNode nodes[512];
+        CRBNode **slot, *p, *q, *i;
+        CRBTree t = {};
+        char a[48], b[48];
+        size_t j, k, l, n_a, n_b;
+
+        /* compare random keys with long common prefixes, skipping a part */
+        for (j = 0; j < 4096; ++j) {
+                n_a = rand() % sizeof(a);
+                n_b = rand() % sizeof(b);
+                for (k = 0; k < sizeof(a); ++k)
+                        a[k] = b[k] = 'a';
+                a[rand() % sizeof(a)] = 'b';
+                b[rand() % sizeof(b)] = 'b';
+
+                for (k = 0; k < C_MIN(n_a, n_b) && a[k] == b[k]; ++k)
+                        /* empty */ ;
+
+                l = rand() % (k + 1);
+                c_assert(c_rbtree_compare_bytes(a, n_a, b, n_b, &l) == test_bytes_compare(a, n_a, b, n_b));
+                c_assert(l == k);
+        }
+
+        /* hierarchical keys share prefixes of varying length */
+        for (j = 0; j < C_ARRAY_SIZE(nodes); ++j) {
+                k = (j * 97) % C_ARRAY_SIZE(nodes);
+                snprintf(nodes[j].key, sizeof(nodes[j].key), "/srv/data/%s/%zu/%zu",
+                         (k % 3) ? "shared/with/a/long/prefix" : "short", k % 7, k);
+                nodes[j].rb.key = nodes[j].key;
+                nodes[j].rb.n_key = strlen(nodes[j].key);
+
+                slot = c_rbtree_find_slot_bytes(&t, nodes[j].rb.key, nodes[j].rb.n_key, &p);
+                c_assert(slot);
+                c_rbtree_add(&t, p, slot, &nodes[j].rb.node);
+        }
+
+        /* verify order, lookups, and lower bounds of keys not in the tree */
+        p = NULL;
+        c_rbtree_for_each(i, &t) {
+                BytesNode *n = c_rbnode_entry(i, BytesNode, rb.node);
+
+                c_assert(c_rbtree_find_node_bytes(&t, n->rb.key, n->rb.n_key) == i);
+                c_assert(!c_rbtree_find_slot_bytes(&t, n->rb.key, n->rb.n_key, &q) && q == i);
+                c_assert(c_rbtree_find_lower_bound_bytes(&t, n->rb.key, n->rb.n_key) == i);
+
+                if (p) {
+                        BytesNode *o = c_rbnode_entry(p, BytesNode, rb.node);
+
+                        c_assert(test_bytes_compare(o->key, o->rb.n_key, n->key, n->rb.n_key) < 0);
+                }
+
+                /* a key extended by one byte orders right before the next */
+                memcpy(a, n->key, n->rb.n_key);
+                a[n->rb.n_key] = 0;
+                c_assert(!c_rbtree_find_node_bytes(&t, a, n->rb.n_key + 1));
+                c_assert(c_rbtree_find_lower_bound_bytes(&t, a, n->rb.n_key + 1) == c_rbnode_next(i));
+
+                p = i;
+        }
+        c_assert(!c_rbtree_find_lower_bound_bytes(&t, "/t", 2));
+        c_assert(c_rbtree_find_lower_bound_bytes(&t, "", 0) == c_rbtree_first(&t));
+}
+
 int main(int argc, char **argv) {
         /* we want stable tests, so use fixed seed */
         srand(0xdeadbeef);
 
         test_map();
+        test_eytzinger();
+        test_merge();
+        test_reposition();
+        test_replace();
+        test_insert_or_get();
+        test_multimap();
+        test_hinted();
+        test_bytes();
         return 0;
 }
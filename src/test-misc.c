@@ -59,8 +59,151 @@ static void test_move(void) {
         c_assert(c_rbtree_is_empty(&t2));
 }
 
+typedef struct {
+        unsigned long key;
+        CRBNode rb;
+} TestEntry;
+
+typedef struct {
+        TestEntry *entries;
+        size_t n_entries;
+} TestRelocation;
+
+static int test_compare(CRBTree *t, void *k, CRBNode *n) {
+        unsigned long key = (unsigned long)k;
+        TestEntry *entry = c_rbnode_entry(n, TestEntry, rb);
+
+        return (key < entry->key) ? -1 : (key > entry->key) ? 1 : 0;
+}
+
+static CRBNode *test_relocate_fn(CRBTree *t, CRBNode *n, void *userdata) {
+        TestRelocation *relocation = userdata;
+        TestEntry *from = c_rbnode_entry(n, TestEntry, rb), *to;
+
+        to = &relocation->entries[relocation->n_entries++];
+        *to = *from;
+        from->key = -1;
+        return &to->rb;
+}
+
+static void test_relocate_verify(CRBTree *t, TestEntry *entries, size_t n_entries) {
+        CRBNode *n;
+        size_t i = 0;
+
+        c_rbtree_for_each(n, t) {
+                c_assert(c_rbnode_entry(n, TestEntry, rb)->key == i);
+                c_assert(!n->left || c_rbnode_parent(n->left) == n);
+                c_assert(!n->right || c_rbnode_parent(n->right) == n);
+                c_assert((void *)n >= (void *)entries);
+                c_assert((void *)n < (void *)(entries + n_entries));
+                ++i;
+        }
+        c_assert(i == n_entries);
+}
+
+static void test_relocate(void) {
+        TestEntry from[256], to[256], *entry;
+        TestRelocation relocation;
+        CRBTree t = C_RBTREE_INIT;
+        CRBNode **slot, *p, *n;
+        size_t i;
+
+        for (i = 0; i < C_ARRAY_SIZE(from); ++i) {
+                from[i].key = (i * 7) % C_ARRAY_SIZE(from);
+                slot = c_rbtree_find_slot(&t, test_compare, (void *)from[i].key, &p);
+                c_assert(slot);
+                c_rbtree_add(&t, p, slot, &from[i].rb);
+        }
+
+        /* relocate in pre-order, see test_relocate_layout() for the exact layouts */
+        relocation = (TestRelocation){ .entries = to };
+        c_rbtree_relocate(&t, C_RBTREE_RELOCATE_PREORDER, test_relocate_fn, &relocation);
+        c_assert(relocation.n_entries == C_ARRAY_SIZE(to));
+        test_relocate_verify(&t, to, C_ARRAY_SIZE(to));
+
+        for (i = 0; i < C_ARRAY_SIZE(from); ++i)
+                c_assert(from[i].key == (unsigned long)-1);
+
+        for (i = 0, n = c_rbtree_last_postorder(&t); n; n = c_rbnode_prev_postorder(n))
+                ++i;
+        c_assert(i == C_ARRAY_SIZE(to));
+        c_assert(t.root == &to[0].rb);
+        c_assert(!to[0].rb.left || to[0].rb.left == &to[1].rb);
+
+        /* relocate back in van Emde Boas order */
+        relocation = (TestRelocation){ .entries = from };
+        c_rbtree_relocate(&t, C_RBTREE_RELOCATE_VEB, test_relocate_fn, &relocation);
+        c_assert(relocation.n_entries == C_ARRAY_SIZE(from));
+        test_relocate_verify(&t, from, C_ARRAY_SIZE(from));
+        c_assert(t.root == &from[0].rb);
+
+        /* the root back-pointer must be intact for the rebalancing to work */
+        for (i = 0; i < C_ARRAY_SIZE(from); ++i) {
+                entry = c_rbtree_find_entry(&t, test_compare, (void *)i, TestEntry, rb);
+                c_assert(entry);
+                c_rbnode_unlink(&entry->rb);
+        }
+        c_assert(c_rbtree_is_empty(&t));
+
+        /* pending relaxed insertions grow the tree beyond its black-height */
+        for (i = 0; i < C_ARRAY_SIZE(from); ++i) {
+                from[i].key = i;
+                slot = c_rbtree_find_slot(&t, test_compare, (void *)i, &p);
+                c_assert(slot);
+                c_rbtree_add_relaxed(&t, p, slot, &from[i].rb);
+        }
+
+        relocation = (TestRelocation){ .entries = to };
+        c_rbtree_relocate(&t, C_RBTREE_RELOCATE_VEB, test_relocate_fn, &relocation);
+        c_assert(relocation.n_entries == C_ARRAY_SIZE(to));
+        test_relocate_verify(&t, to, C_ARRAY_SIZE(to));
+
+        c_rbnode_repaint(c_rbtree_last(&t));
+        while (t.root)
+                c_rbnode_unlink(t.root);
+}
+
+static void test_relocate_layout(void) {
+        static const unsigned long preorder[] = { 7, 3, 1, 0, 2, 5, 4, 6, 11, 9, 8, 10, 13, 12, 14 };
+        static const unsigned long veb[] = { 7, 3, 11, 1, 0, 2, 5, 4, 6, 9, 8, 10, 13, 12, 14 };
+        TestEntry from[C_ARRAY_SIZE(veb)], to[C_ARRAY_SIZE(veb)];
+        CRBNode *nodes[C_ARRAY_SIZE(veb)];
+        TestRelocation relocation;
+        CRBTree t = C_RBTREE_INIT;
+        size_t i;
+
+        /* build a perfect tree of height 4 */
+        for (i = 0; i < C_ARRAY_SIZE(nodes); ++i) {
+                from[i].key = i;
+                nodes[i] = &from[i].rb;
+        }
+        c_rbtree_build(&t, nodes, C_ARRAY_SIZE(nodes));
+
+        /* in pre-order, each node is followed by its left sub-tree */
+        relocation = (TestRelocation){ .entries = to };
+        c_rbtree_relocate(&t, C_RBTREE_RELOCATE_PREORDER, test_relocate_fn, &relocation);
+        test_relocate_verify(&t, to, C_ARRAY_SIZE(to));
+        for (i = 0; i < C_ARRAY_SIZE(to); ++i)
+                c_assert(to[i].key == preorder[i]);
+
+        /*
+         * In van Emde Boas order, the top tree of height 2 comes first,
+         * followed by the bottom trees of height 2 from left to right.
+         */
+        relocation = (TestRelocation){ .entries = from };
+        c_rbtree_relocate(&t, C_RBTREE_RELOCATE_VEB, test_relocate_fn, &relocation);
+        test_relocate_verify(&t, from, C_ARRAY_SIZE(from));
+        for (i = 0; i < C_ARRAY_SIZE(from); ++i)
+                c_assert(from[i].key == veb[i]);
+
+        while (t.root)
+                c_rbnode_unlink(t.root);
+}
+
 int main(int argc, char **argv) {
         test_move();
+        test_relocate();
+        test_relocate_layout();
 
         return 0;
 }
@@ -0,0 +1,210 @@
+/*
+ * Benchmark Parallel Traversal
+ * This partitions a tree into ranges via c_rbtree_partition() and traverses
+ * them on a growing number of threads. Ranges are handed out on demand from a
+ * shared counter, so threads that finish early take over the remaining work.
+ * Each range is summarized independently, and the summaries are reduced in
+ * range order, which must match the summary of a sequential traversal.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <c-stdaux.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "c-rbtree.h"
+#include "c-rbtree-private.h"
+
+#define TEST_N_NODES (1UL << 18)
+#define TEST_MAX_THREADS 64
+#define TEST_RANGES_PER_THREAD 8
+
+typedef struct {
+        unsigned long key;
+        CRBNode rb;
+} Node;
+
+typedef struct {
+        unsigned long first;
+        unsigned long last;
+        uint64_t sum;
+        uint64_t n_nodes;
+} Summary;
+
+typedef struct {
+        CRBNode *ranges[TEST_MAX_THREADS * TEST_RANGES_PER_THREAD];
+        Summary summaries[TEST_MAX_THREADS * TEST_RANGES_PER_THREAD];
+        size_t n_ranges;
+        atomic_size_t next;
+} Context;
+
+#define node_from_rb(_rb) ((Node *)((char *)(_rb) - offsetof(Node, rb)))
+
+static int compare(CRBTree *t, void *k, CRBNode *n) {
+        unsigned long key = (unsigned long)k;
+        Node *node = node_from_rb(n);
+
+        return (key < node->key) ? -1 : (key > node->key) ? 1 : 0;
+}
+
+static uint64_t now(void) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(CLOCK_MONOTONIC, &ts);
+        c_assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static void summarize(Summary *s, CRBNode *first, CRBNode *end) {
+        unsigned long key;
+        CRBNode *i;
+
+        *s = (Summary){};
+        for (i = first; i != end; i = c_rbnode_next(i)) {
+                key = node_from_rb(i)->key;
+                if (s->n_nodes)
+                        c_assert(key > s->last);
+                else
+                        s->first = key;
+                s->last = key;
+                s->sum += key;
+                ++s->n_nodes;
+        }
+}
+
+static void *traverse_thread(void *userdata) {
+        Context *ctx = userdata;
+        CRBNode *end;
+        size_t i;
+
+        while ((i = atomic_fetch_add(&ctx->next, 1)) < ctx->n_ranges) {
+                end = (i + 1 < ctx->n_ranges) ? ctx->ranges[i + 1] : NULL;
+                summarize(&ctx->summaries[i], ctx->ranges[i], end);
+        }
+
+        return NULL;
+}
+
+static void run(CRBTree *t, size_t n_threads, size_t n_ranges, Summary *total, uint64_t *maxp) {
+        pthread_t threads[TEST_MAX_THREADS];
+        Context ctx;
+        Summary *s;
+        size_t i;
+        int r;
+
+        ctx.n_ranges = c_rbtree_partition(t, ctx.ranges, n_ranges);
+        c_assert(ctx.n_ranges >= 1);
+        c_assert(ctx.n_ranges <= n_ranges);
+        atomic_init(&ctx.next, 0);
+
+        for (i = 0; i < n_threads; ++i) {
+                r = pthread_create(&threads[i], NULL, traverse_thread, &ctx);
+                c_assert(!r);
+        }
+
+        for (i = 0; i < n_threads; ++i) {
+                r = pthread_join(threads[i], NULL);
+                c_assert(!r);
+        }
+
+        /* reduce in range order, which must continue the global order */
+        *total = (Summary){};
+        *maxp = 0;
+        for (i = 0; i < ctx.n_ranges; ++i) {
+                s = &ctx.summaries[i];
+                c_assert(s->n_nodes);
+
+                if (total->n_nodes)
+                        c_assert(s->first > total->last);
+                else
+                        total->first = s->first;
+                total->last = s->last;
+                total->sum += s->sum;
+                total->n_nodes += s->n_nodes;
+                *maxp = C_MAX(*maxp, s->n_nodes);
+        }
+}
+
+static void test_ranges(CRBTree *t) {
+        CRBNode *ranges[64], *i;
+        size_t j, k, n;
+
+        /* ranges must cover all nodes exactly once, in order */
+        for (j = 0; j <= C_ARRAY_SIZE(ranges); j += 1 + j / 4) {
+                n = c_rbtree_partition(t, ranges, j);
+                c_assert(n <= j);
+                c_assert(!j || n);
+
+                k = 0;
+                for (i = c_rbtree_first(t); i && n; i = c_rbnode_next(i)) {
+                        if (k < n && i == ranges[k])
+                                ++k;
+                        c_assert(k > 0);
+                }
+                c_assert(k == n);
+        }
+}
+
+static void test_partition(void) {
+        uint64_t ts, max;
+        CRBTree t = C_RBTREE_INIT;
+        CRBNode **slot, *p, *range;
+        Summary ref, total;
+        size_t i, n_cpus;
+        Node *nodes;
+        long v;
+
+        v = sysconf(_SC_NPROCESSORS_ONLN);
+        n_cpus = C_MIN(C_MAX(v, 1L), (long)TEST_MAX_THREADS);
+
+        /* empty trees have no ranges */
+        c_assert(!c_rbtree_partition(&t, &range, 1));
+
+        nodes = malloc(TEST_N_NODES * sizeof(*nodes));
+        c_assert(nodes);
+
+        for (i = 0; i < TEST_N_NODES; ++i) {
+                do {
+                        nodes[i].key = rand();
+                        slot = c_rbtree_find_slot(&t, compare, (void *)nodes[i].key, &p);
+                } while (!slot);
+                c_rbtree_add(&t, p, slot, &nodes[i].rb);
+        }
+
+        test_ranges(&t);
+
+        summarize(&ref, c_rbtree_first(&t), NULL);
+        c_assert(ref.n_nodes == TEST_N_NODES);
+
+        fprintf(stderr, "threads  ranges  max-range       time\n");
+
+        for (i = 1; i <= 2 * n_cpus && i <= TEST_MAX_THREADS; i *= 2) {
+                ts = now();
+                run(&t, i, i * TEST_RANGES_PER_THREAD, &total, &max);
+                ts = now() - ts;
+
+                c_assert(!memcmp(&total, &ref, sizeof(ref)));
+
+                fprintf(stderr, "%7zu %7zu %10"PRIu64" %8"PRIu64"us\n",
+                        i, i * TEST_RANGES_PER_THREAD, max, ts / 1000);
+        }
+
+        while (t.root)
+                c_rbnode_unlink(t.root);
+        free(nodes);
+}
+
+int main(int argc, char **argv) {
+        /* we want stable tests, so use fixed seed */
+        srand(0xdeadbeef);
+
+        test_partition();
+        return 0;
+}
@@ -0,0 +1,266 @@
+/*
+ * Tests for Persistent Trees
+ * This runs random modifications on a persistent tree, while keeping a set of
+ * snapshots around. The current version and all snapshots are verified
+ * against a plain reference model after each step, and the RB-Tree invariants
+ * are validated. Furthermore, a reader thread traverses snapshots without
+ * holding any lock, while a writer keeps modifying the tree.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <c-stdaux.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "c-rbtree-persist.h"
+
+#define TEST_N_KEYS 512
+#define TEST_N_SNAPSHOTS 8
+
+typedef struct {
+        unsigned long key;
+        CRBPersistNode rb;
+} Node;
+
+typedef struct {
+        CRBPersistNode *root;
+        bool keys[TEST_N_KEYS];
+} Snapshot;
+
+typedef struct {
+        pthread_mutex_t lock;
+        CRBPersistTree tree;
+        size_t n_nodes;
+        atomic_bool done;
+} Context;
+
+#define node_from_rb(_rb) ((Node *)((char *)(_rb) - offsetof(Node, rb)))
+
+static atomic_size_t n_allocated;
+
+static int compare(void *k, CRBPersistNode *n) {
+        unsigned long key = (unsigned long)k;
+        Node *node = node_from_rb(n);
+
+        return (key < node->key) ? -1 : (key > node->key) ? 1 : 0;
+}
+
+static Node *node_new(unsigned long key) {
+        Node *node;
+
+        node = malloc(sizeof(*node));
+        c_assert(node);
+        node->key = key;
+        atomic_fetch_add(&n_allocated, 1);
+        return node;
+}
+
+static CRBPersistNode *node_copy(CRBPersistNode *n, void *userdata) {
+        return &node_new(node_from_rb(n)->key)->rb;
+}
+
+static void node_free(CRBPersistNode *n, void *userdata) {
+        atomic_fetch_sub(&n_allocated, 1);
+        free(node_from_rb(n));
+}
+
+/* validate the RB-Tree invariants and return the black-height */
+static size_t validate(CRBPersistNode *n, unsigned long lo, unsigned long hi, size_t *countp) {
+        size_t bl, br;
+
+        if (!n)
+                return 0;
+
+        c_assert(node_from_rb(n)->key >= lo && node_from_rb(n)->key < hi);
+        c_assert(atomic_load(&n->__n_refs) > 0);
+
+        if (n->__rank & 1) {
+                c_assert(!n->left || !(n->left->__rank & 1));
+                c_assert(!n->right || !(n->right->__rank & 1));
+        }
+
+        bl = validate(n->left, lo, node_from_rb(n)->key, countp);
+        br = validate(n->right, node_from_rb(n)->key + 1, hi, countp);
+        c_assert(bl == br);
+        c_assert((n->__rank >> 1) == bl + !(n->__rank & 1));
+
+        ++*countp;
+        return bl + !(n->__rank & 1);
+}
+
+static void verify(CRBPersistNode *root, const bool *keys) {
+        CRBPersistNode *n;
+        CRBPersistIter it;
+        size_t i, count = 0;
+
+        c_assert(!root || !(root->__rank & 1));
+        validate(root, 0, TEST_N_KEYS, &count);
+
+        i = 0;
+        c_rbtree_persist_for_each(n, &it, root) {
+                while (!keys[i])
+                        ++i;
+                c_assert(node_from_rb(n)->key == i++);
+        }
+        while (i < TEST_N_KEYS)
+                c_assert(!keys[i++]);
+
+        for (i = 0; i < TEST_N_KEYS; i += 7) {
+                n = c_rbtree_persist_find(root, compare, (void *)i);
+                c_assert(!n == !keys[i]);
+        }
+}
+
+static void test_snapshots(void) {
+        Snapshot snapshots[TEST_N_SNAPSHOTS] = {};
+        CRBPersistTree t;
+        bool keys[TEST_N_KEYS] = {};
+        CRBPersistNode *n;
+        CRBPersistIter it;
+        unsigned long key;
+        size_t i, j;
+        Node *node;
+        bool r;
+
+        c_rbtree_persist_init(&t, node_copy, node_free, NULL);
+
+        for (i = 0; i < 16 * TEST_N_KEYS; ++i) {
+                key = rand() % TEST_N_KEYS;
+                if (rand() % 3) {
+                        node = node_new(key);
+                        r = c_rbtree_persist_add(&t, compare, (void *)key, &node->rb);
+                        c_assert(r == !keys[key]);
+                        if (!r)
+                                node_free(&node->rb, NULL);
+                        keys[key] = true;
+                } else {
+                        r = c_rbtree_persist_remove(&t, compare, (void *)key);
+                        c_assert(r == keys[key]);
+                        keys[key] = false;
+                }
+
+                verify(t.root, keys);
+
+                /* every now and then, replace a snapshot and verify all */
+                if (!(i % 64)) {
+                        j = rand() % TEST_N_SNAPSHOTS;
+                        c_rbtree_persist_release(&t, snapshots[j].root);
+                        snapshots[j].root = c_rbtree_persist_snapshot(&t);
+                        memcpy(snapshots[j].keys, keys, sizeof(keys));
+
+                        for (j = 0; j < TEST_N_SNAPSHOTS; ++j)
+                                verify(snapshots[j].root, snapshots[j].keys);
+                }
+        }
+
+        /* seeking positions at the lower bound */
+        for (key = 0; key <= TEST_N_KEYS; ++key) {
+                c_rbtree_persist_iter_seek(&it, t.root, compare, (void *)key);
+                n = c_rbtree_persist_iter_next(&it);
+                for (i = key; i < TEST_N_KEYS && !keys[i]; ++i)
+                        /* empty */ ;
+                if (i < TEST_N_KEYS)
+                        c_assert(n && node_from_rb(n)->key == i);
+                else
+                        c_assert(!n);
+        }
+
+        /* drain the tree, verifying the snapshots are unaffected */
+        for (key = 0; key < TEST_N_KEYS; ++key)
+                c_rbtree_persist_remove(&t, compare, (void *)key);
+        c_assert(!t.root);
+
+        for (j = 0; j < TEST_N_SNAPSHOTS; ++j) {
+                verify(snapshots[j].root, snapshots[j].keys);
+                c_rbtree_persist_release(&t, snapshots[j].root);
+        }
+
+        c_rbtree_persist_deinit(&t);
+        c_assert(!atomic_load(&n_allocated));
+}
+
+static void *read_thread(void *userdata) {
+        Context *ctx = userdata;
+        CRBPersistNode *root, *n;
+        CRBPersistIter it;
+        size_t n_nodes, count;
+        unsigned long last;
+        int r;
+
+        do {
+                r = pthread_mutex_lock(&ctx->lock);
+                c_assert(!r);
+                root = c_rbtree_persist_snapshot(&ctx->tree);
+                n_nodes = ctx->n_nodes;
+                r = pthread_mutex_unlock(&ctx->lock);
+                c_assert(!r);
+
+                /* traverse the snapshot without holding the lock */
+                count = 0;
+                last = 0;
+                c_rbtree_persist_for_each(n, &it, root) {
+                        c_assert(!count || node_from_rb(n)->key > last);
+                        last = node_from_rb(n)->key;
+                        ++count;
+                }
+                c_assert(count == n_nodes);
+
+                c_rbtree_persist_release(&ctx->tree, root);
+        } while (!atomic_load(&ctx->done));
+
+        return NULL;
+}
+
+static void test_concurrent(void) {
+        Context ctx = { .lock = PTHREAD_MUTEX_INITIALIZER };
+        unsigned long key;
+        pthread_t thread;
+        Node *node;
+        size_t i;
+        int r;
+
+        c_rbtree_persist_init(&ctx.tree, node_copy, node_free, NULL);
+        atomic_init(&ctx.done, false);
+
+        r = pthread_create(&thread, NULL, read_thread, &ctx);
+        c_assert(!r);
+
+        for (i = 0; i < 64 * TEST_N_KEYS; ++i) {
+                key = rand() % TEST_N_KEYS;
+                node = node_new(key);
+
+                r = pthread_mutex_lock(&ctx.lock);
+                c_assert(!r);
+                if (c_rbtree_persist_add(&ctx.tree, compare, (void *)key, &node->rb)) {
+                        ++ctx.n_nodes;
+                        node = NULL;
+                } else if (c_rbtree_persist_remove(&ctx.tree, compare, (void *)key)) {
+                        --ctx.n_nodes;
+                }
+                r = pthread_mutex_unlock(&ctx.lock);
+                c_assert(!r);
+
+                if (node)
+                        node_free(&node->rb, NULL);
+        }
+
+        atomic_store(&ctx.done, true);
+        r = pthread_join(thread, NULL);
+        c_assert(!r);
+
+        c_rbtree_persist_deinit(&ctx.tree);
+        c_assert(!atomic_load(&n_allocated));
+}
+
+int main(int argc, char **argv) {
+        /* we want stable tests, so use fixed seed */
+        srand(0xdeadbeef);
+
+        test_snapshots();
+        test_concurrent();
+        return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * Benchmark Relaxed Balancing
+ * This measures the latency of individual insertions, comparing c_rbtree_add()
+ * against c_rbtree_add_relaxed(). In relaxed mode, pending nodes are
+ * repainted in between insertions once their number exceeds a threshold,
+ * which bounds the depth of the tree. The time spent repainting is reported
+ * separately.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <c-stdaux.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "c-rbtree.h"
+#include "c-rbtree-private.h"
+
+#define TEST_N_NODES (1UL << 18)
+#define TEST_N_PENDING 64
+
+typedef struct {
+        unsigned long key;
+        CRBNode rb;
+} Node;
+
+#define node_from_rb(_rb) ((Node *)((char *)(_rb) - offsetof(Node, rb)))
+
+static int compare(CRBTree *t, void *k, CRBNode *n) {
+        unsigned long key = (unsigned long)k;
+        Node *node = node_from_rb(n);
+
+        return (key < node->key) ? -1 : (key > node->key) ? 1 : 0;
+}
+
+static int compare_latencies(const void *a, const void *b) {
+        const uint64_t *la = a, *lb = b;
+
+        return (*la < *lb) ? -1 : (*la > *lb) ? 1 : 0;
+}
+
+static uint64_t now(void) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(CLOCK_MONOTONIC, &ts);
+        c_assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static void report(const char *method, uint64_t *latencies, uint64_t ts_repaint) {
+        uint64_t total = 0;
+        size_t i;
+
+        for (i = 0; i < TEST_N_NODES; ++i)
+                total += latencies[i];
+
+        qsort(latencies, TEST_N_NODES, sizeof(*latencies), compare_latencies);
+        fprintf(stderr, "%-9s %6"PRIu64"ns %6"PRIu64"ns %8"PRIu64"ns %9"PRIu64"us %9"PRIu64"us\n",
+                method,
+                latencies[TEST_N_NODES / 2],
+                latencies[TEST_N_NODES * 99 / 100],
+                latencies[TEST_N_NODES - 1],
+                total / 1000,
+                ts_repaint / 1000);
+}
+
+static void verify(CRBTree *t, Node *nodes) {
+        CRBNode *i, *o = NULL;
+        size_t n = 0;
+
+        for (i = c_rbtree_first(t); i; o = i, i = c_rbnode_next(i), ++n) {
+                c_assert(!o || node_from_rb(o)->key < node_from_rb(i)->key);
+                c_assert(!c_rbnode_is_red(i) || !i->left || c_rbnode_is_black(i->left));
+                c_assert(!c_rbnode_is_red(i) || !i->right || c_rbnode_is_black(i->right));
+        }
+        c_assert(n == TEST_N_NODES);
+
+        for (n = 0; n < TEST_N_NODES; ++n)
+                c_rbnode_init(&nodes[n].rb);
+        c_rbtree_init(t);
+}
+
+static void test_latency(void) {
+        uint64_t *latencies, ts, ts_repaint;
+        CRBNode **pending, **slot, *p;
+        CRBTree t = C_RBTREE_INIT;
+        size_t i, j, n_pending;
+        Node *nodes;
+
+        nodes = malloc(TEST_N_NODES * sizeof(*nodes));
+        pending = malloc(TEST_N_NODES * sizeof(*pending));
+        latencies = malloc(TEST_N_NODES * sizeof(*latencies));
+        c_assert(nodes && pending && latencies);
+
+        /* multiplying by an odd constant permutes the keys */
+        for (i = 0; i < TEST_N_NODES; ++i) {
+                nodes[i].key = (i * 2654435761UL) & 0xffffffffUL;
+                c_rbnode_init(&nodes[i].rb);
+        }
+
+        fprintf(stderr, "method        p50      p99          max     total   repaint\n");
+
+        for (i = 0; i < TEST_N_NODES; ++i) {
+                ts = now();
+                slot = c_rbtree_find_slot(&t, compare, (void *)nodes[i].key, &p);
+                c_assert(slot);
+                c_rbtree_add(&t, p, slot, &nodes[i].rb);
+                latencies[i] = now() - ts;
+        }
+        verify(&t, nodes);
+        report("add", latencies, 0);
+
+        /* repaint all pending nodes once there are too many */
+        ts_repaint = 0;
+        n_pending = 0;
+        for (i = 0; i < TEST_N_NODES; ++i) {
+                ts = now();
+                slot = c_rbtree_find_slot(&t, compare, (void *)nodes[i].key, &p);
+                c_assert(slot);
+                if (c_rbtree_add_relaxed(&t, p, slot, &nodes[i].rb))
+                        pending[n_pending++] = &nodes[i].rb;
+                latencies[i] = now() - ts;
+
+                if (n_pending >= TEST_N_PENDING) {
+                        ts = now();
+                        for (j = 0; j < n_pending; ++j)
+                                c_rbnode_repaint(pending[j]);
+                        n_pending = 0;
+                        ts_repaint += now() - ts;
+                }
+        }
+        for (j = 0; j < n_pending; ++j)
+                c_rbnode_repaint(pending[j]);
+        verify(&t, nodes);
+        report("relaxed", latencies, ts_repaint);
+
+        free(latencies);
+        free(pending);
+        free(nodes);
+}
+
+int main(int argc, char **argv) {
+        /* we want stable tests, so use fixed seed */
+        srand(0xdeadbeef);
+
+        test_latency();
+        return 0;
+}
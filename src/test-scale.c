@@ -0,0 +1,231 @@
+/*
+ * Benchmark Lockless Reader Scaling
+ * This runs a growing number of reader threads, each hammering lookups on a
+ * tree, while a single writer constantly inserts and removes nodes. Half of
+ * the keys are never removed, so any lookup of them must succeed. Plain
+ * lockless lookups can miss them if they race a rebalancing operation, while
+ * sequence counted lookups retry instead. For each setup, this reports the
+ * reader and writer throughput, as well as the rate of misses (plain) or
+ * retries (sequence counted) of the readers. Unlinked nodes are never reused
+ * while readers run, but released once they are done.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <c-stdaux.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "c-rbtree.h"
+#include "c-rbtree-private.h"
+#include "c-rbtree-sync.h"
+
+#define TEST_N_KEYS (1UL << 14)
+#define TEST_MAX_READERS 64
+#define TEST_DURATION_NS (UINT64_C(100) * 1000 * 1000)
+
+typedef struct Node Node;
+
+struct Node {
+        unsigned long key;
+        CRBNode rb;
+        Node *next;
+};
+
+typedef struct {
+        CRBSeqTree tree;
+        bool seq;
+        atomic_bool done;
+} Context;
+
+typedef struct {
+        Context *ctx;
+        unsigned long seed;
+        uint64_t n_lookups;
+        uint64_t n_misses;
+} Reader;
+
+#define node_from_rb(_rb) ((Node *)((char *)(_rb) - offsetof(Node, rb)))
+
+static int compare(CRBTree *t, void *k, CRBNode *n) {
+        unsigned long key = (unsigned long)k;
+        Node *node = node_from_rb(n);
+
+        return (key < node->key) ? -1 : (key > node->key) ? 1 : 0;
+}
+
+static uint64_t now(void) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(CLOCK_MONOTONIC, &ts);
+        c_assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static void insert(CRBSeqTree *st, Node *node) {
+        CRBNode **slot, *p;
+
+        slot = c_rbtree_find_slot(&st->tree, compare, (void *)node->key, &p);
+        c_assert(slot);
+        c_rbtree_seq_add(st, p, slot, &node->rb);
+}
+
+static void *read_thread(void *userdata) {
+        Reader *reader = userdata;
+        Context *ctx = reader->ctx;
+        unsigned long key, seq, seed = reader->seed;
+        CRBNode *n;
+
+        do {
+                seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+                key = ((seed >> 33) % TEST_N_KEYS) * 2;
+
+                if (ctx->seq) {
+                        /* count retries as misses */
+                        for (;;) {
+                                seq = c_rbtree_seq_read_begin(&ctx->tree);
+                                n = c_rbtree_find_node(&ctx->tree.tree, compare, (void *)key);
+                                if (!c_rbtree_seq_read_retry(&ctx->tree, seq))
+                                        break;
+                                ++reader->n_misses;
+                        }
+                        c_assert(n);
+                } else {
+                        n = c_rbtree_find_node(&ctx->tree.tree, compare, (void *)key);
+                        if (!n)
+                                ++reader->n_misses;
+                }
+
+                ++reader->n_lookups;
+        } while (!atomic_load_explicit(&ctx->done, memory_order_relaxed));
+
+        return NULL;
+}
+
+static void run(Node *nodes, size_t n_readers, bool seq) {
+        uint64_t ts, n_writes = 0, n_lookups = 0, n_misses = 0;
+        pthread_t threads[TEST_MAX_READERS];
+        Reader readers[TEST_MAX_READERS];
+        Context ctx = { .seq = seq };
+        Node **odd, *retired = NULL, *n;
+        size_t i, j;
+        int r;
+
+        c_rbtree_seq_init(&ctx.tree);
+        atomic_init(&ctx.done, false);
+
+        odd = calloc(TEST_N_KEYS, sizeof(*odd));
+        c_assert(odd);
+
+        for (i = 0; i < TEST_N_KEYS; ++i) {
+                c_rbnode_init(&nodes[i].rb);
+                insert(&ctx.tree, &nodes[i]);
+        }
+
+        for (i = 0; i < n_readers; ++i) {
+                readers[i].ctx = &ctx;
+                readers[i].seed = i + 1;
+                readers[i].n_lookups = 0;
+                readers[i].n_misses = 0;
+
+                r = pthread_create(&threads[i], NULL, read_thread, &readers[i]);
+                c_assert(!r);
+        }
+
+        /*
+         * Randomly add and remove odd keys until the time is up. Readers
+         * might still be on unlinked nodes, so those are left untouched and
+         * only released at the end. Each insertion uses a new node.
+         */
+        ts = now();
+        do {
+                for (i = 0; i < 1024; ++i) {
+                        j = rand() % TEST_N_KEYS;
+                        if (odd[j]) {
+                                c_rbtree_seq_write_begin(&ctx.tree);
+                                c_rbnode_unlink_stale(&odd[j]->rb);
+                                c_rbtree_seq_write_end(&ctx.tree);
+                                odd[j]->next = retired;
+                                retired = odd[j];
+                                odd[j] = NULL;
+                        } else {
+                                odd[j] = malloc(sizeof(*odd[j]));
+                                c_assert(odd[j]);
+                                odd[j]->key = 2 * j + 1;
+                                c_rbnode_init(&odd[j]->rb);
+                                insert(&ctx.tree, odd[j]);
+                        }
+                }
+                n_writes += i;
+        } while (now() - ts < TEST_DURATION_NS);
+
+        atomic_store(&ctx.done, true);
+        ts = now() - ts;
+
+        for (i = 0; i < n_readers; ++i) {
+                r = pthread_join(threads[i], NULL);
+                c_assert(!r);
+                n_lookups += readers[i].n_lookups;
+                n_misses += readers[i].n_misses;
+        }
+
+        fprintf(stderr, "%7zu %6s %12"PRIu64" %12"PRIu64" %10"PRIu64"\n",
+                n_readers, seq ? "seq" : "plain",
+                n_lookups * 1000 * 1000 * 1000 / ts,
+                n_writes * 1000 * 1000 * 1000 / ts,
+                n_lookups ? n_misses * 1000 * 1000 / n_lookups : 0);
+
+        while ((n = retired)) {
+                retired = n->next;
+                free(n);
+        }
+        for (i = 0; i < TEST_N_KEYS; ++i) {
+                if (odd[i]) {
+                        c_rbnode_unlink(&odd[i]->rb);
+                        free(odd[i]);
+                }
+                c_rbnode_unlink(&nodes[i].rb);
+        }
+        c_assert(c_rbtree_is_empty(&ctx.tree.tree));
+
+        free(odd);
+}
+
+static void test_scale(void) {
+        size_t i, n_cpus;
+        long v;
+        Node *nodes;
+
+        v = sysconf(_SC_NPROCESSORS_ONLN);
+        n_cpus = C_MIN(C_MAX(v, 1L), (long)TEST_MAX_READERS);
+
+        nodes = calloc(TEST_N_KEYS, sizeof(*nodes));
+        c_assert(nodes);
+
+        for (i = 0; i < TEST_N_KEYS; ++i)
+                nodes[i].key = 2 * i;
+
+        fprintf(stderr, "readers   mode   lookups/s     writes/s  misses/1M\n");
+
+        /* scale up to one reader per CPU, and beyond to over-commit */
+        for (i = 1; i <= 2 * n_cpus && i <= TEST_MAX_READERS; i *= 2) {
+                run(nodes, i, false);
+                run(nodes, i, true);
+        }
+
+        free(nodes);
+}
+
+int main(int argc, char **argv) {
+        /* we want stable tests, so use fixed seed */
+        srand(0xdeadbeef);
+
+        test_scale();
+        return 0;
+}
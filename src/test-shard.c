@@ -0,0 +1,394 @@
+/*
+ * Tests for Key-Range Sharding
+ * A single tree needs a single writer lock, which limits writes to a single
+ * CPU. This distributes an ordered set across multiple trees, each owning a
+ * key-range and protected by its own lock. Shard boundaries are rebalanced
+ * via c_rbtree_split() and c_rbtree_concat() in sub-linear time, splitting
+ * hot shards and merging cold ones, while writers keep running.
+ * This verifies the sharded set retains ordered iteration and lower-bound
+ * lookups across shards, and compares write throughput of a growing number of
+ * writer threads against a single tree.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <c-stdaux.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "c-rbtree.h"
+#include "c-rbtree-private.h"
+
+#define TEST_N_KEYS (1UL << 16)
+#define TEST_MAX_SHARDS 64
+#define TEST_MAX_WRITERS 16
+
+typedef struct {
+        unsigned long key;
+        CRBNode rb;
+} Node;
+
+typedef struct {
+        pthread_mutex_t lock;
+        CRBTree tree;
+        unsigned long lo;
+        atomic_ulong n_ops;
+} Shard;
+
+typedef struct {
+        pthread_rwlock_t lock;
+        Shard *shards[TEST_MAX_SHARDS];
+        size_t n_shards;
+        atomic_bool done;
+} ShardMap;
+
+typedef struct {
+        ShardMap *map;
+        Node *nodes;
+        size_t index;
+        size_t n_writers;
+} Writer;
+
+#define node_from_rb(_rb) ((Node *)((char *)(_rb) - offsetof(Node, rb)))
+
+static int compare(CRBTree *t, void *k, CRBNode *n) {
+        unsigned long key = (unsigned long)k;
+        Node *node = node_from_rb(n);
+
+        return (key < node->key) ? -1 : (key > node->key) ? 1 : 0;
+}
+
+static uint64_t now(void) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(CLOCK_MONOTONIC, &ts);
+        c_assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static Shard *shard_new(unsigned long lo) {
+        Shard *shard;
+        int r;
+
+        shard = malloc(sizeof(*shard));
+        c_assert(shard);
+
+        r = pthread_mutex_init(&shard->lock, NULL);
+        c_assert(!r);
+        c_rbtree_init(&shard->tree);
+        shard->lo = lo;
+        atomic_init(&shard->n_ops, 0);
+
+        return shard;
+}
+
+static void shard_free(Shard *shard) {
+        c_assert(c_rbtree_is_empty(&shard->tree));
+        pthread_mutex_destroy(&shard->lock);
+        free(shard);
+}
+
+static void map_init(ShardMap *map) {
+        int r;
+
+        r = pthread_rwlock_init(&map->lock, NULL);
+        c_assert(!r);
+        map->shards[0] = shard_new(0);
+        map->n_shards = 1;
+        atomic_init(&map->done, false);
+}
+
+static void map_deinit(ShardMap *map) {
+        size_t i;
+
+        for (i = 0; i < map->n_shards; ++i)
+                shard_free(map->shards[i]);
+        pthread_rwlock_destroy(&map->lock);
+}
+
+/* return the index of the shard owning @key; the map must be locked */
+static size_t map_find(ShardMap *map, unsigned long key) {
+        size_t lo = 0, hi = map->n_shards - 1, mid;
+
+        while (lo < hi) {
+                mid = lo + (hi - lo + 1) / 2;
+                if (map->shards[mid]->lo <= key)
+                        lo = mid;
+                else
+                        hi = mid - 1;
+        }
+
+        return lo;
+}
+
+static void map_insert(ShardMap *map, Node *node) {
+        CRBNode **slot, *p;
+        Shard *shard;
+
+        pthread_rwlock_rdlock(&map->lock);
+        shard = map->shards[map_find(map, node->key)];
+
+        pthread_mutex_lock(&shard->lock);
+        slot = c_rbtree_find_slot(&shard->tree, compare, (void *)node->key, &p);
+        c_assert(slot);
+        c_rbtree_add(&shard->tree, p, slot, &node->rb);
+        pthread_mutex_unlock(&shard->lock);
+
+        atomic_fetch_add_explicit(&shard->n_ops, 1, memory_order_relaxed);
+        pthread_rwlock_unlock(&map->lock);
+}
+
+static void map_remove(ShardMap *map, Node *node) {
+        Shard *shard;
+
+        pthread_rwlock_rdlock(&map->lock);
+        shard = map->shards[map_find(map, node->key)];
+
+        pthread_mutex_lock(&shard->lock);
+        c_rbnode_unlink(&node->rb);
+        pthread_mutex_unlock(&shard->lock);
+
+        atomic_fetch_add_explicit(&shard->n_ops, 1, memory_order_relaxed);
+        pthread_rwlock_unlock(&map->lock);
+}
+
+/* return the first node not ordering before @key, across all shards */
+static Node *map_lower_bound(ShardMap *map, unsigned long key) {
+        CRBNode *n = NULL;
+        Shard *shard;
+        size_t i;
+
+        pthread_rwlock_rdlock(&map->lock);
+        for (i = map_find(map, key); !n && i < map->n_shards; ++i) {
+                shard = map->shards[i];
+                pthread_mutex_lock(&shard->lock);
+                n = c_rbtree_find_lower_bound(&shard->tree, compare, (void *)key);
+                pthread_mutex_unlock(&shard->lock);
+        }
+        pthread_rwlock_unlock(&map->lock);
+
+        return n ? node_from_rb(n) : NULL;
+}
+
+/* split the shard at index @i at the middle of its key-range */
+static bool map_split(ShardMap *map, size_t i) {
+        Shard *shard = map->shards[i], *next;
+        unsigned long hi;
+        CRBNode *n;
+
+        if (map->n_shards >= TEST_MAX_SHARDS)
+                return false;
+
+        hi = (i + 1 < map->n_shards) ? map->shards[i + 1]->lo : TEST_N_KEYS;
+        if (hi - shard->lo < 2)
+                return false;
+
+        next = shard_new(shard->lo + (hi - shard->lo) / 2);
+        n = c_rbtree_find_lower_bound(&shard->tree, compare, (void *)next->lo);
+        if (n)
+                c_rbtree_split(&shard->tree, n, &next->tree);
+
+        memmove(map->shards + i + 2, map->shards + i + 1,
+                (map->n_shards - i - 1) * sizeof(*map->shards));
+        map->shards[i + 1] = next;
+        ++map->n_shards;
+        return true;
+}
+
+/* merge the shard at index @i + 1 into the shard at index @i */
+static void map_merge(ShardMap *map, size_t i) {
+        Shard *next = map->shards[i + 1];
+
+        c_rbtree_concat(&map->shards[i]->tree, &next->tree);
+
+        memmove(map->shards + i + 1, map->shards + i + 2,
+                (map->n_shards - i - 2) * sizeof(*map->shards));
+        --map->n_shards;
+        shard_free(next);
+}
+
+/*
+ * Split the hottest shard, and merge the coldest pair of adjacent shards, if
+ * their load is well below the average. Boundaries move without visiting the
+ * nodes of the shards, so the writers are only blocked for a short time.
+ */
+static void map_rebalance(ShardMap *map, size_t n_target) {
+        unsigned long ops[TEST_MAX_SHARDS], cold = ULONG_MAX, total = 0;
+        size_t i, i_hot = 0, i_cold = 0;
+
+        pthread_rwlock_wrlock(&map->lock);
+
+        for (i = 0; i < map->n_shards; ++i) {
+                ops[i] = atomic_exchange(&map->shards[i]->n_ops, 0);
+                total += ops[i];
+                if (ops[i] > ops[i_hot])
+                        i_hot = i;
+                if (i > 0 && ops[i - 1] + ops[i] < cold) {
+                        cold = ops[i - 1] + ops[i];
+                        i_cold = i - 1;
+                }
+        }
+
+        if (map->n_shards < n_target)
+                map_split(map, i_hot);
+        else if (map->n_shards > 1 && cold < total / map->n_shards / 2)
+                map_merge(map, i_cold);
+
+        pthread_rwlock_unlock(&map->lock);
+}
+
+static void *write_thread(void *userdata) {
+        Writer *writer = userdata;
+        size_t i;
+
+        /* insert all nodes of this writer, then remove every other one */
+        for (i = writer->index; i < TEST_N_KEYS; i += writer->n_writers)
+                map_insert(writer->map, &writer->nodes[i]);
+        for (i = writer->index; i < TEST_N_KEYS; i += writer->n_writers)
+                if (writer->nodes[i].key % 2)
+                        map_remove(writer->map, &writer->nodes[i]);
+
+        return NULL;
+}
+
+static void *rebalance_thread(void *userdata) {
+        ShardMap *map = userdata;
+
+        while (!atomic_load(&map->done)) {
+                map_rebalance(map, 16);
+                usleep(100);
+        }
+
+        return NULL;
+}
+
+static void verify(ShardMap *map) {
+        unsigned long key = 0;
+        CRBNode *n;
+        Node *node;
+        size_t i;
+
+        /* ordered iteration across shards yields all even keys */
+        for (i = 0; i < map->n_shards; ++i) {
+                c_assert(!i || map->shards[i]->lo > map->shards[i - 1]->lo);
+
+                c_rbtree_for_each(n, &map->shards[i]->tree) {
+                        node = node_from_rb(n);
+                        c_assert(node->key == key);
+                        c_assert(node->key >= map->shards[i]->lo);
+                        c_assert(i + 1 == map->n_shards || node->key < map->shards[i + 1]->lo);
+                        key += 2;
+                }
+        }
+        c_assert(key == TEST_N_KEYS);
+
+        /* lower bounds are found across shard boundaries */
+        for (key = 0; key < TEST_N_KEYS; ++key) {
+                node = map_lower_bound(map, key);
+                if (key == TEST_N_KEYS - 1)
+                        c_assert(!node);
+                else
+                        c_assert(node && node->key == ((key + 1) & ~1UL));
+        }
+}
+
+static uint64_t run(Node *nodes, size_t n_writers, bool rebalance, size_t *n_shardsp) {
+        pthread_t threads[TEST_MAX_WRITERS], rebalancer;
+        Writer writers[TEST_MAX_WRITERS];
+        ShardMap map;
+        uint64_t ts;
+        size_t i;
+        int r;
+
+        map_init(&map);
+        for (i = 0; i < TEST_N_KEYS; ++i)
+                c_rbnode_init(&nodes[i].rb);
+
+        if (rebalance) {
+                r = pthread_create(&rebalancer, NULL, rebalance_thread, &map);
+                c_assert(!r);
+        }
+
+        ts = now();
+        for (i = 0; i < n_writers; ++i) {
+                writers[i].map = &map;
+                writers[i].nodes = nodes;
+                writers[i].index = i;
+                writers[i].n_writers = n_writers;
+
+                r = pthread_create(&threads[i], NULL, write_thread, &writers[i]);
+                c_assert(!r);
+        }
+
+        for (i = 0; i < n_writers; ++i) {
+                r = pthread_join(threads[i], NULL);
+                c_assert(!r);
+        }
+        ts = now() - ts;
+
+        if (rebalance) {
+                atomic_store(&map.done, true);
+                r = pthread_join(rebalancer, NULL);
+                c_assert(!r);
+        }
+
+        verify(&map);
+        *n_shardsp = map.n_shards;
+
+        /* merging all shards yields a single valid tree */
+        while (map.n_shards > 1)
+                map_merge(&map, 0);
+        verify(&map);
+
+        for (i = 0; i < TEST_N_KEYS; ++i)
+                c_rbnode_unlink(&nodes[i].rb);
+        map_deinit(&map);
+
+        /* writes per second */
+        return (TEST_N_KEYS + TEST_N_KEYS / 2) * UINT64_C(1000000000) / C_MAX(ts, (uint64_t)1);
+}
+
+static void test_shard(void) {
+        size_t i, n_cpus, n_shards;
+        uint64_t single, sharded;
+        Node *nodes;
+        long v;
+
+        v = sysconf(_SC_NPROCESSORS_ONLN);
+        n_cpus = C_MIN(C_MAX(v, 1L), (long)TEST_MAX_WRITERS);
+
+        nodes = malloc(TEST_N_KEYS * sizeof(*nodes));
+        c_assert(nodes);
+
+        /* spread keys across the whole range, so writers hit all shards */
+        for (i = 0; i < TEST_N_KEYS; ++i)
+                nodes[i].key = (i * 40503UL) % TEST_N_KEYS;
+
+        fprintf(stderr, "writers     single/s    sharded/s  shards\n");
+
+        for (i = 1; i <= 2 * n_cpus && i <= TEST_MAX_WRITERS; i *= 2) {
+                single = run(nodes, i, false, &n_shards);
+                c_assert(n_shards == 1);
+                sharded = run(nodes, i, true, &n_shards);
+                fprintf(stderr, "%7zu %12"PRIu64" %12"PRIu64" %7zu\n",
+                        i, single, sharded, n_shards);
+        }
+
+        free(nodes);
+}
+
+int main(int argc, char **argv) {
+        /* we want stable tests, so use fixed seed */
+        srand(0xdeadbeef);
+
+        test_shard();
+        return 0;
+}
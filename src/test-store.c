@@ -0,0 +1,131 @@
+/*
+ * Benchmark Tree Modifications
+ * All left/right stores during tree modification go through c_rbtree_store(),
+ * which either uses release-stores to support lockless readers, or plain
+ * stores if lockless readers are disabled via C_RBTREE_LOCKLESS. This
+ * benchmarks the rotation-heavy insertion and removal paths. It is built
+ * against both variants of the library, so the numbers can be compared.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <c-stdaux.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "c-rbtree.h"
+#include "c-rbtree-private.h"
+
+#ifndef C_RBTREE_LOCKLESS
+#  define C_RBTREE_LOCKLESS 1
+#endif
+
+#define TEST_N_NODES (1UL << 16)
+#define TEST_N_ROUNDS 8
+
+typedef struct {
+        unsigned long key;
+        CRBNode rb;
+} Node;
+
+#define node_from_rb(_rb) ((Node *)((char *)(_rb) - offsetof(Node, rb)))
+
+static int compare(CRBTree *t, void *k, CRBNode *n) {
+        unsigned long key = (unsigned long)k;
+        Node *node = node_from_rb(n);
+
+        return (key < node->key) ? -1 : (key > node->key) ? 1 : 0;
+}
+
+static uint64_t now(void) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        c_assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static void shuffle(Node **nodes, size_t n_memb) {
+        size_t i, j;
+        Node *t;
+
+        for (i = 0; i < n_memb; ++i) {
+                j = rand() % n_memb;
+                t = nodes[j];
+                nodes[j] = nodes[i];
+                nodes[i] = t;
+        }
+}
+
+static void run(Node **nodes, uint64_t *addp, uint64_t *removep) {
+        CRBTree t = C_RBTREE_INIT;
+        CRBNode **slot, *p;
+        uint64_t ts;
+        size_t i, j;
+
+        *addp = 0;
+        *removep = 0;
+
+        for (j = 0; j < TEST_N_ROUNDS; ++j) {
+                ts = now();
+                for (i = 0; i < TEST_N_NODES; ++i) {
+                        slot = c_rbtree_find_slot(&t, compare, (void *)nodes[i]->key, &p);
+                        c_assert(slot);
+                        c_rbtree_add(&t, p, slot, &nodes[i]->rb);
+                }
+                *addp += now() - ts;
+
+                ts = now();
+                for (i = 0; i < TEST_N_NODES; ++i)
+                        c_rbnode_unlink(&nodes[i]->rb);
+                *removep += now() - ts;
+
+                c_assert(c_rbtree_is_empty(&t));
+        }
+
+        *addp = *addp * 1000 / (TEST_N_ROUNDS * TEST_N_NODES);
+        *removep = *removep * 1000 / (TEST_N_ROUNDS * TEST_N_NODES);
+}
+
+static void test_store(void) {
+        uint64_t add, remove;
+        Node **nodes;
+        size_t i;
+
+        nodes = malloc(TEST_N_NODES * sizeof(*nodes));
+        c_assert(nodes);
+
+        for (i = 0; i < TEST_N_NODES; ++i) {
+                nodes[i] = malloc(sizeof(*nodes[i]));
+                c_assert(nodes[i]);
+                nodes[i]->key = i;
+                c_rbnode_init(&nodes[i]->rb);
+        }
+
+        fprintf(stderr, "stores: %s\n", C_RBTREE_LOCKLESS ? "lockless" : "plain");
+        fprintf(stderr, "                add      remove\n");
+
+        /* sequential insertion rotates on every other insert */
+        run(nodes, &add, &remove);
+        fprintf(stderr, "sequential: %3"PRIu64".%03"PRIu64"ns %3"PRIu64".%03"PRIu64"ns\n",
+                add / 1000, add % 1000, remove / 1000, remove % 1000);
+
+        shuffle(nodes, TEST_N_NODES);
+        run(nodes, &add, &remove);
+        fprintf(stderr, "    random: %3"PRIu64".%03"PRIu64"ns %3"PRIu64".%03"PRIu64"ns\n",
+                add / 1000, add % 1000, remove / 1000, remove % 1000);
+
+        for (i = 0; i < TEST_N_NODES; ++i)
+                free(nodes[i]);
+        free(nodes);
+}
+
+int main(int argc, char **argv) {
+        /* we want stable tests, so use fixed seed */
+        srand(0xdeadbeef);
+
+        test_store();
+        return 0;
+}
@@ -0,0 +1,352 @@
+/*
+ * Tests for Sequence Counted Trees
+ * This runs lockless readers in parallel to a writer. The tree contains a
+ * fixed set of even keys, which are never removed, and the writer constantly
+ * adds and removes odd keys, causing rebalancing throughout the tree. The
+ * readers verify that each lookup in a read section produces correct results,
+ * even though plain lockless lookups might skip sub-trees.
+ * Additionally, the writer releases removed nodes via epoch-based reclamation
+ * or hazard pointers, and the readers verify they never access released nodes.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <c-stdaux.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "c-rbtree.h"
+#include "c-rbtree-private.h"
+#include "c-rbtree-sync.h"
+
+#define TEST_N_KEYS (1UL << 12)
+#define TEST_N_READERS 4
+#define TEST_N_ROUNDS (1UL << 16)
+#define TEST_MAGIC 0x5eedUL
+
+enum {
+        TEST_MODE_RELINK,
+        TEST_MODE_EPOCH,
+        TEST_MODE_HAZARD,
+};
+
+typedef struct {
+        unsigned long key;
+        unsigned long magic;
+        CRBNode rb;
+        CRBEpochEntry epoch;
+        CRBHazardEntry hazard;
+} Node;
+
+typedef struct {
+        unsigned int mode;
+        CRBSeqTree tree;
+        CRBEpoch epoch;
+        CRBHazard hazard;
+        atomic_bool done;
+} Context;
+
+typedef struct {
+        Context *ctx;
+        CRBEpochReader *epoch;
+        CRBHazardReader *hazard;
+        unsigned long seed;
+        unsigned long n_lookups;
+        unsigned long n_iterations;
+} Reader;
+
+#define node_from_rb(_rb) ((Node *)((char *)(_rb) - offsetof(Node, rb)))
+
+static int compare(CRBTree *t, void *k, CRBNode *n) {
+        unsigned long key = (unsigned long)k;
+        Node *node = node_from_rb(n);
+
+        /* released nodes are poisoned, so verify we never see them */
+        c_assert(node->magic == TEST_MAGIC);
+
+        return (key < node->key) ? -1 : (key > node->key) ? 1 : 0;
+}
+
+static void insert(CRBSeqTree *st, Node *node) {
+        CRBNode **slot, *p;
+
+        slot = c_rbtree_find_slot(&st->tree, compare, (void *)node->key, &p);
+        c_assert(slot);
+        c_rbtree_seq_add(st, p, slot, &node->rb);
+}
+
+static void release(Node *node, size_t *n_released) {
+        node->magic = 0;
+        free(node);
+        ++*n_released;
+}
+
+static void release_epoch(CRBEpochEntry *entry, void *userdata) {
+        release((Node *)((char *)entry - offsetof(Node, epoch)), userdata);
+}
+
+static void release_hazard(CRBHazardEntry *entry, void *userdata) {
+        release((Node *)((char *)entry - offsetof(Node, hazard)), userdata);
+}
+
+static CRBNode *find_node(Reader *reader, unsigned long key) {
+        CRBSeqTree *st = &reader->ctx->tree;
+        unsigned long seq;
+        CRBNode *n;
+
+        if (reader->ctx->mode != TEST_MODE_HAZARD)
+                return c_rbtree_seq_find_node(st, compare, (void *)key);
+
+        do {
+                seq = c_rbtree_seq_read_begin(st);
+                n = c_rbtree_hazard_find_node(reader->hazard, &st->tree, compare, (void *)key);
+        } while (c_rbtree_seq_read_retry(st, seq));
+
+        return n;
+}
+
+static CRBNode *find_lower_bound(Reader *reader, unsigned long key) {
+        CRBSeqTree *st = &reader->ctx->tree;
+        unsigned long seq;
+        CRBNode *n;
+
+        if (reader->ctx->mode != TEST_MODE_HAZARD)
+                return c_rbtree_seq_find_lower_bound(st, compare, (void *)key);
+
+        do {
+                seq = c_rbtree_seq_read_begin(st);
+                n = c_rbtree_hazard_find_lower_bound(reader->hazard, &st->tree, compare, (void *)key);
+        } while (c_rbtree_seq_read_retry(st, seq));
+
+        return n;
+}
+
+/* verify @n follows @next in the tree, and return the key following @n */
+static unsigned long verify_next(CRBNode *n, unsigned long next) {
+        Node *node = node_from_rb(n);
+
+        /* odd keys might be skipped, but even keys must not */
+        c_assert(node->magic == TEST_MAGIC);
+        c_assert(node->key >= next);
+        c_assert(node->key <= ((next + 1) & ~1UL));
+
+        return node->key + 1;
+}
+
+static void iterate(Reader *reader) {
+        CRBSeqTree *st = &reader->ctx->tree;
+        unsigned long next = 0, seq;
+        CRBNode *n;
+
+        if (reader->ctx->mode != TEST_MODE_HAZARD) {
+                seq = c_rbtree_seq_read_begin(st);
+                n = c_rbtree_seq_find_lower_bound(st, compare, (void *)next);
+                while (n) {
+                        next = verify_next(n, next);
+                        n = c_rbtree_seq_next(st, n, &seq);
+                        if (!n)
+                                n = c_rbtree_seq_find_lower_bound(st, compare, (void *)next);
+                }
+        } else {
+                do {
+                        seq = c_rbtree_seq_read_begin(st);
+                        n = c_rbtree_hazard_find_lower_bound(reader->hazard, &st->tree,
+                                                             compare, (void *)next);
+                        while (n && !c_rbtree_seq_read_retry(st, seq)) {
+                                next = verify_next(n, next);
+                                n = c_rbtree_hazard_next(reader->hazard, &st->tree, n);
+                        }
+                } while (n || c_rbtree_seq_read_retry(st, seq));
+        }
+
+        c_assert(next >= 2 * TEST_N_KEYS - 1);
+}
+
+static void *read_thread(void *userdata) {
+        Reader *reader = userdata;
+        Context *ctx = reader->ctx;
+        unsigned long key, seed = reader->seed;
+        size_t i;
+        CRBNode *n;
+        Node *node;
+
+        do {
+                seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+                key = (seed >> 33) % (2 * TEST_N_KEYS);
+
+                c_rbtree_epoch_read_begin(&ctx->epoch, reader->epoch);
+
+                /* even keys are always present */
+                n = find_node(reader, key & ~1UL);
+                c_assert(n);
+                c_assert(node_from_rb(n)->key == (key & ~1UL));
+
+                /* the lower bound of an odd key is itself or its successor */
+                n = find_lower_bound(reader, key | 1UL);
+                if (n) {
+                        node = node_from_rb(n);
+                        c_assert(node->magic == TEST_MAGIC);
+                        c_assert(node->key == (key | 1UL) || node->key == (key | 1UL) + 1);
+                } else {
+                        c_assert((key | 1UL) == 2 * TEST_N_KEYS - 1);
+                }
+
+                /*
+                 * Occasionally stall the first reader while it holds a node,
+                 * to verify it does not prevent reclamation of other nodes.
+                 */
+                if (ctx->mode == TEST_MODE_HAZARD && reader->seed == 1 && !(key % 16)) {
+                        for (i = 0; i < 64; ++i)
+                                sched_yield();
+                        c_assert(!n || node_from_rb(n)->magic == TEST_MAGIC);
+                }
+
+                ++reader->n_lookups;
+
+                /* occasionally iterate the tree and verify all even keys are seen */
+                if (!(key % 64)) {
+                        iterate(reader);
+                        ++reader->n_iterations;
+                }
+
+                c_rbtree_hazard_release(reader->hazard);
+                c_rbtree_epoch_read_end(reader->epoch);
+        } while (!atomic_load(&ctx->done));
+
+        return NULL;
+}
+
+static void test_sync(unsigned int mode) {
+        CRBHazardReader hazard_slots[TEST_N_READERS] = {};
+        CRBEpochReader epoch_slots[TEST_N_READERS] = {};
+        size_t i, j, n_released = 0, n_retired = 0;
+        pthread_t threads[TEST_N_READERS];
+        Reader readers[TEST_N_READERS];
+        Node *nodes, *odd[TEST_N_KEYS] = {};
+        bool linked[TEST_N_KEYS] = {};
+        Context ctx = { .mode = mode };
+        CRBSeqTree *st = &ctx.tree;
+        int r;
+
+        c_rbtree_seq_init(st);
+        c_rbtree_epoch_init(&ctx.epoch, epoch_slots, TEST_N_READERS);
+        c_rbtree_hazard_init(&ctx.hazard, hazard_slots, TEST_N_READERS);
+        atomic_init(&ctx.done, false);
+
+        nodes = calloc(2 * TEST_N_KEYS, sizeof(*nodes));
+        c_assert(nodes);
+
+        for (i = 0; i < 2 * TEST_N_KEYS; ++i) {
+                nodes[i].key = i;
+                nodes[i].magic = TEST_MAGIC;
+                c_rbnode_init(&nodes[i].rb);
+        }
+
+        for (i = 0; i < TEST_N_KEYS; ++i)
+                insert(st, &nodes[2 * i]);
+
+        for (i = 0; i < TEST_N_READERS; ++i) {
+                readers[i].ctx = &ctx;
+                readers[i].epoch = &epoch_slots[i];
+                readers[i].hazard = &hazard_slots[i];
+                readers[i].seed = i + 1;
+                readers[i].n_lookups = 0;
+                readers[i].n_iterations = 0;
+
+                r = pthread_create(&threads[i], NULL, read_thread, &readers[i]);
+                c_assert(!r);
+        }
+
+        /*
+         * Randomly add and remove odd keys. Without reclamation, unlinked
+         * nodes are never released, but they are linked again later on, so
+         * readers might observe them anywhere in the tree.
+         * With reclamation, a new node is allocated for each insertion, and
+         * unlinked nodes are released once no reader can reach them anymore.
+         */
+        for (i = 0; i < TEST_N_ROUNDS; ++i) {
+                j = rand() % TEST_N_KEYS;
+
+                if (mode == TEST_MODE_RELINK) {
+                        if (linked[j])
+                                c_rbtree_seq_unlink(st, &nodes[2 * j + 1].rb);
+                        else
+                                insert(st, &nodes[2 * j + 1]);
+                        linked[j] = !linked[j];
+                } else if (odd[j]) {
+                        c_rbtree_seq_write_begin(st);
+                        if (mode == TEST_MODE_EPOCH)
+                                c_rbtree_epoch_unlink(&ctx.epoch, &odd[j]->rb, &odd[j]->epoch);
+                        else
+                                c_rbtree_hazard_unlink(&ctx.hazard, &odd[j]->rb, &odd[j]->hazard);
+                        c_rbtree_seq_write_end(st);
+                        odd[j] = NULL;
+                        ++n_retired;
+
+                        if (n_retired % 64)
+                                continue;
+
+                        if (mode == TEST_MODE_EPOCH) {
+                                c_rbtree_epoch_reclaim(&ctx.epoch, release_epoch, &n_released);
+                        } else {
+                                c_rbtree_hazard_reclaim(&ctx.hazard, release_hazard, &n_released);
+                                /* a stalled reader pins at most two nodes */
+                                c_assert(c_rbtree_hazard_n_retired(&ctx.hazard) <= 2 * TEST_N_READERS);
+                        }
+                } else {
+                        odd[j] = malloc(sizeof(*odd[j]));
+                        c_assert(odd[j]);
+                        odd[j]->key = 2 * j + 1;
+                        odd[j]->magic = TEST_MAGIC;
+                        c_rbnode_init(&odd[j]->rb);
+                        insert(st, odd[j]);
+                }
+        }
+
+        atomic_store(&ctx.done, true);
+
+        for (i = 0; i < TEST_N_READERS; ++i) {
+                r = pthread_join(threads[i], NULL);
+                c_assert(!r);
+                c_assert(readers[i].n_lookups > 0);
+                fprintf(stderr, "reader %zu: %lu lookups, %lu iterations\n",
+                        i, readers[i].n_lookups, readers[i].n_iterations);
+        }
+
+        /* without readers, everything retired can be released */
+        c_rbtree_epoch_reclaim(&ctx.epoch, release_epoch, &n_released);
+        c_assert(!c_rbtree_epoch_has_retired(&ctx.epoch));
+        c_rbtree_hazard_reclaim(&ctx.hazard, release_hazard, &n_released);
+        c_assert(!c_rbtree_hazard_n_retired(&ctx.hazard));
+        c_assert(n_released == n_retired);
+
+        /* without readers, stale nodes can be reinitialized */
+        for (i = 0; i < TEST_N_KEYS; ++i)
+                if (!linked[i])
+                        c_rbnode_init(&nodes[2 * i + 1].rb);
+
+        for (i = 0; i < TEST_N_KEYS; ++i) {
+                if (odd[i]) {
+                        c_rbnode_unlink(&odd[i]->rb);
+                        free(odd[i]);
+                }
+        }
+        for (i = 0; i < 2 * TEST_N_KEYS; ++i)
+                c_rbnode_unlink(&nodes[i].rb);
+        c_assert(c_rbtree_is_empty(&st->tree));
+
+        free(nodes);
+}
+
+int main(int argc, char **argv) {
+        /* we want stable tests, so use fixed seed */
+        srand(0xdeadbeef);
+
+        test_sync(TEST_MODE_RELINK);
+        test_sync(TEST_MODE_EPOCH);
+        test_sync(TEST_MODE_HAZARD);
+        return 0;
+}
@@ -0,0 +1,230 @@
+/*
+ * Tests for Weighted Rebuilds
+ * This builds a tree, runs Zipf-distributed lookups on it while counting the
+ * hits of each entry, and then rebuilds the tree based on those counters. The
+ * number of nodes visited per lookup, as well as the lookup time, is compared
+ * between the plain tree and the weighted tree.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <c-stdaux.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "c-rbtree.h"
+#include "c-rbtree-private.h"
+
+#define TEST_N_NODES (1UL << 14)
+#define TEST_N_LOOKUPS (1UL << 18)
+
+typedef struct {
+        unsigned long key;
+        unsigned long hits;
+        CRBNode rb;
+} Node;
+
+#define node_from_rb(_rb) ((Node *)((char *)(_rb) - offsetof(Node, rb)))
+
+static int compare(CRBTree *t, void *k, CRBNode *n) {
+        unsigned long key = (unsigned long)k;
+        Node *node = node_from_rb(n);
+
+        return (key < node->key) ? -1 : (key > node->key) ? 1 : 0;
+}
+
+static unsigned long weight(CRBTree *t, CRBNode *n, void *userdata) {
+        return node_from_rb(n)->hits;
+}
+
+static uint64_t now(void) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(CLOCK_MONOTONIC, &ts);
+        c_assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static void shuffle(unsigned long *keys, size_t n_memb) {
+        unsigned long t;
+        size_t i, j;
+
+        for (i = 0; i < n_memb; ++i) {
+                j = rand() % n_memb;
+                t = keys[j];
+                keys[j] = keys[i];
+                keys[i] = t;
+        }
+}
+
+/* verify the RB-Tree invariants and return the black-height */
+static size_t validate(CRBNode *n, CRBNode *p, size_t *heightp) {
+        size_t bh_left, bh_right, h_left = 0, h_right = 0;
+
+        if (!n) {
+                *heightp = 0;
+                return 0;
+        }
+
+        c_assert(c_rbnode_parent(n) == p);
+        c_assert(!p || c_rbnode_is_black(p) || c_rbnode_is_black(n));
+        c_assert(!n->left || node_from_rb(n->left)->key < node_from_rb(n)->key);
+        c_assert(!n->right || node_from_rb(n->right)->key > node_from_rb(n)->key);
+
+        bh_left = validate(n->left, n, &h_left);
+        bh_right = validate(n->right, n, &h_right);
+        c_assert(bh_left == bh_right);
+
+        *heightp = 1 + C_MAX(h_left, h_right);
+        return bh_left + c_rbnode_is_black(n);
+}
+
+static void lookup(CRBTree *t, unsigned long *keys, uint64_t *nsp, uint64_t *depthp) {
+        uint64_t ts, depth = 0;
+        CRBNode *i;
+        size_t j;
+
+        /* count visited nodes (not timed) */
+        for (j = 0; j < TEST_N_LOOKUPS; ++j) {
+                for (i = t->root; i; ) {
+                        int v = compare(t, (void *)keys[j], i);
+
+                        ++depth;
+                        if (v < 0)
+                                i = i->left;
+                        else if (v > 0)
+                                i = i->right;
+                        else
+                                break;
+                }
+        }
+
+        ts = now();
+        for (j = 0; j < TEST_N_LOOKUPS; ++j) {
+                i = c_rbtree_find_node(t, compare, (void *)keys[j]);
+                c_assert(i);
+        }
+
+        *nsp = (now() - ts) / TEST_N_LOOKUPS;
+        *depthp = depth * 100 / TEST_N_LOOKUPS;
+}
+
+static void test_weighted(void) {
+        uint64_t ns_plain, ns_weighted, depth_plain, depth_weighted;
+        unsigned long *ranks, *keys;
+        size_t i, j, bh, h, max_height;
+        double *cdf, sum, u;
+        CRBTree t = C_RBTREE_INIT;
+        CRBNode **slot, *p;
+        Node *nodes, *node;
+
+        nodes = malloc(TEST_N_NODES * sizeof(*nodes));
+        ranks = malloc(TEST_N_NODES * sizeof(*ranks));
+        cdf = malloc(TEST_N_NODES * sizeof(*cdf));
+        keys = malloc(TEST_N_LOOKUPS * sizeof(*keys));
+        c_assert(nodes && ranks && cdf && keys);
+
+        /* insert all keys in random order */
+        for (i = 0; i < TEST_N_NODES; ++i)
+                ranks[i] = i;
+        shuffle(ranks, TEST_N_NODES);
+
+        for (i = 0; i < TEST_N_NODES; ++i) {
+                nodes[i].key = ranks[i];
+                nodes[i].hits = 0;
+                slot = c_rbtree_find_slot(&t, compare, (void *)nodes[i].key, &p);
+                c_assert(slot);
+                c_rbtree_add(&t, p, slot, &nodes[i].rb);
+        }
+
+        /*
+         * Assign a Zipf popularity (s = 1) to each key, with the ranks in
+         * random order, and generate the lookup sequence from it.
+         */
+        shuffle(ranks, TEST_N_NODES);
+        for (i = 0, sum = 0; i < TEST_N_NODES; ++i) {
+                sum += 1.0 / (i + 1);
+                cdf[i] = sum;
+        }
+
+        for (j = 0; j < TEST_N_LOOKUPS; ++j) {
+                size_t lo = 0, hi = TEST_N_NODES - 1;
+
+                u = sum * rand() / RAND_MAX;
+                while (lo < hi) {
+                        size_t mid = lo + (hi - lo) / 2;
+
+                        if (cdf[mid] < u)
+                                lo = mid + 1;
+                        else
+                                hi = mid;
+                }
+                keys[j] = ranks[lo];
+        }
+
+        /* count the hits of each entry on a first round of lookups */
+        for (j = 0; j < TEST_N_LOOKUPS; ++j) {
+                node = c_rbtree_find_entry(&t, compare, (void *)keys[j], Node, rb);
+                c_assert(node);
+                ++node->hits;
+        }
+
+        lookup(&t, keys, &ns_plain, &depth_plain);
+
+        c_rbtree_rebuild_weighted(&t, weight, NULL);
+
+        /* verify the tree is valid and within the height bound */
+        bh = validate(t.root, NULL, &h);
+        c_assert(bh > 0);
+        for (max_height = 0; (1UL << max_height) - 1 < TEST_N_NODES; max_height += 2)
+                /* empty */ ;
+        c_assert(h <= max_height);
+
+        lookup(&t, keys, &ns_weighted, &depth_weighted);
+
+        fprintf(stderr, "            lookup   nodes/lookup\n");
+        fprintf(stderr, "   plain: %6"PRIu64"ns %6"PRIu64".%02"PRIu64"\n",
+                ns_plain, depth_plain / 100, depth_plain % 100);
+        fprintf(stderr, "weighted: %6"PRIu64"ns %6"PRIu64".%02"PRIu64"\n",
+                ns_weighted, depth_weighted / 100, depth_weighted % 100);
+
+        c_assert(depth_weighted < depth_plain);
+
+        /* verify the weighted tree can be modified as usual */
+        shuffle(ranks, TEST_N_NODES);
+        for (i = 0; i < TEST_N_NODES; ++i) {
+                node = c_rbtree_find_entry(&t, compare, (void *)ranks[i], Node, rb);
+                c_assert(node);
+                c_rbnode_unlink(&node->rb);
+                if (!(i % 1024))
+                        validate(t.root, NULL, &h);
+        }
+        c_assert(c_rbtree_is_empty(&t));
+
+        /* a tree without any hits is rebuilt as balanced tree */
+        for (i = 0; i < TEST_N_NODES; ++i) {
+                nodes[i].hits = 0;
+                slot = c_rbtree_find_slot(&t, compare, (void *)nodes[i].key, &p);
+                c_assert(slot);
+                c_rbtree_add(&t, p, slot, &nodes[i].rb);
+        }
+        c_rbtree_rebuild_weighted(&t, weight, NULL);
+        validate(t.root, NULL, &h);
+        c_assert(h <= max_height);
+
+        free(keys);
+        free(cdf);
+        free(ranks);
+        free(nodes);
+}
+
+int main(int argc, char **argv) {
+        /* we want stable tests, so use fixed seed */
+        srand(0xdeadbeef);
+
+        test_weighted();
+        return 0;
+}